@@ -0,0 +1,76 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Escrow developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark block propagation along a chain of local peers, full blocks
+# against compact blocks rebuilt from the receivers' mempools.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import time
+
+class CompactBlocksBenchmark(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--nodes", dest="nodes", default=4, type="int",
+                          help="Number of nodes in the relay chain (default: %default)")
+        parser.add_option("--txs", dest="txs", default=200, type="int",
+                          help="Transactions in each block (default: %default)")
+        parser.add_option("--rounds", dest="rounds", default=5, type="int",
+                          help="Blocks to time for each mode (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, self.options.nodes)
+
+    def setup_network(self):
+        self.is_network_split = False
+        self.start_chain(1)
+        # Regtest only takes proof-of-work blocks up to height 200, stay well below it
+        self.nodes[0].setgenerate(True, 30)
+        self.split_coins(2 * self.options.rounds * self.options.txs)
+        sync_blocks(self.nodes)
+
+    def split_coins(self, count):
+        # One confirmed input per relayed transaction, so the wallet never chains
+        # unconfirmed change past the ancestor limit
+        node = self.nodes[0]
+        for chunk in range(0, count, 500):
+            node.sendmany("", dict((node.getnewaddress(), 1) for i in range(min(500, count - chunk))))
+        node.setgenerate(True, 1)
+
+    def start_chain(self, compactblocks):
+        # node i only talks to node i-1, so a block crosses every hop in turn
+        self.nodes = []
+        for i in range(self.options.nodes):
+            self.nodes.append(start_node(i, self.options.tmpdir, ["-compactblocks=%d" % compactblocks]))
+            if i > 0:
+                connect_nodes(self.nodes[i], i - 1)
+
+    def time_blocks(self, compactblocks):
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.start_chain(compactblocks)
+        last = self.nodes[-1]
+        elapsed = 0.0
+        for r in range(self.options.rounds):
+            for t in range(self.options.txs):
+                self.nodes[0].sendtoaddress(last.getnewaddress(), 0.01)
+            sync_mempools(self.nodes)
+            start = time.time()
+            blockhash = self.nodes[0].setgenerate(True, 1)[0]
+            while last.getbestblockhash() != blockhash:
+                time.sleep(0.01)
+            elapsed += time.time() - start
+        return elapsed / self.options.rounds
+
+    def run_test(self):
+        full = self.time_blocks(0)
+        compact = self.time_blocks(1)
+        print("Relayed %d-tx blocks over %d hops: full blocks %.3fs, compact blocks %.3fs (%.2fx)" %
+              (self.options.txs + 1, self.options.nodes - 1, full, compact, full / compact))
+
+if __name__ == '__main__':
+    CompactBlocksBenchmark().main()
@@ -0,0 +1,61 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Escrow developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark initial sync from several local peers, legacy getblocks
+# sync against headers-first sync with parallel block download.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import os.path
+import shutil
+import time
+
+class HeadersFirstSyncBenchmark(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--blocks", dest="blocks", default=190, type="int",
+                          help="Number of blocks to sync, below 200 (default: %default)")
+        parser.add_option("--peers", dest="peers", default=4, type="int",
+                          help="Number of peers serving the chain (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, self.options.peers + 1)
+
+    def setup_network(self):
+        self.is_network_split = False
+        # nodes[0] mines the chain, the other peers get it from there before the benchmark starts
+        self.nodes = [ start_node(0, self.options.tmpdir) ]
+        # Regtest only takes proof-of-work blocks up to height 200
+        assert self.options.blocks < 200, "--blocks must stay below the regtest proof-of-work limit of 200"
+        self.nodes[0].setgenerate(True, self.options.blocks)
+        for i in range(1, self.options.peers):
+            self.nodes.append(start_node(i, self.options.tmpdir))
+            connect_nodes(self.nodes[i], 0)
+        sync_blocks(self.nodes)
+
+    def time_sync(self, headersfirst):
+        n = self.options.peers
+        shutil.rmtree(os.path.join(self.options.tmpdir, "node"+str(n), "regtest"), True)
+        node = start_node(n, self.options.tmpdir, ["-headersfirst=%d" % headersfirst])
+        start = time.time()
+        for i in range(n):
+            connect_nodes(node, i)
+        while node.getblockcount() < self.options.blocks:
+            time.sleep(0.1)
+        elapsed = time.time() - start
+        assert_equal(node.getbestblockhash(), self.nodes[0].getbestblockhash())
+        stop_node(node, n)
+        return elapsed
+
+    def run_test(self):
+        legacy = self.time_sync(0)
+        headersfirst = self.time_sync(1)
+        print("Synced %d blocks from %d peers: getblocks %.2fs, headers-first %.2fs (%.2fx)" %
+              (self.options.blocks, self.options.peers, legacy, headersfirst, legacy / headersfirst))
+
+if __name__ == '__main__':
+    HeadersFirstSyncBenchmark().main()
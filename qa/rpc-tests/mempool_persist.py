@@ -0,0 +1,60 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Escrow developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the mempool is saved on shutdown and reloaded on startup,
+# prioritisation included, unless -persistmempool=0.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import time
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.is_network_split = False
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes(self.nodes[1], 0)
+        self.nodes[0].setgenerate(True, 20)
+        sync_blocks(self.nodes)
+
+    def restart_node(self, i, extra_args=None):
+        stop_node(self.nodes[i], i)
+        self.nodes[i] = start_node(i, self.options.tmpdir, extra_args)
+
+    def wait_for_mempool(self, node, size):
+        # The mempool is reloaded in the background after startup
+        for i in range(100):
+            if len(node.getrawmempool()) == size:
+                return
+            time.sleep(0.1)
+        assert_equal(len(node.getrawmempool()), size)
+
+    def run_test(self):
+        address = self.nodes[0].getnewaddress()
+        txids = [self.nodes[0].sendtoaddress(address, 0.01) for i in range(5)]
+        self.nodes[0].prioritisetransaction(txids[0], 0, 1000)
+        sync_mempools(self.nodes)
+        fee = self.nodes[0].getrawmempool(True)[txids[0]]["descendantfees"]
+
+        print("Restart both nodes, node1 without persistence")
+        self.restart_node(0)
+        self.restart_node(1, ["-persistmempool=0"])
+        self.wait_for_mempool(self.nodes[0], 5)
+        assert_equal(len(self.nodes[1].getrawmempool()), 0)
+        assert_equal(self.nodes[0].getrawmempool(True)[txids[0]]["descendantfees"], fee)
+
+        print("A node that skipped the reload leaves mempool.dat alone")
+        self.restart_node(0, ["-persistmempool=0"])
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+        self.restart_node(0)
+        self.wait_for_mempool(self.nodes[0], 5)
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
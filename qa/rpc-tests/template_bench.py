@@ -0,0 +1,69 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Escrow developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark block template creation (getblocktemplate) against the number
+# of transactions in the mempool.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import time
+
+class TemplateBenchmark(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--sizes", dest="sizes", default="250,500,1000,2000",
+                          help="Comma separated mempool sizes to time (default: %default)")
+        parser.add_option("--rounds", dest="rounds", default=3, type="int",
+                          help="Templates to time for each size (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.is_network_split = False
+        # getblocktemplate refuses to work without a peer
+        self.nodes = start_nodes(2, self.options.tmpdir, [["-debug=bench"], []])
+        connect_nodes(self.nodes[0], 1)
+        # Regtest only takes proof-of-work blocks up to height 200, stay well below it
+        self.nodes[0].setgenerate(True, 30)
+        self.split_coins(max([int(s) for s in self.options.sizes.split(",")]))
+
+    def split_coins(self, count):
+        # One confirmed input per mempool transaction, so the wallet never chains
+        # unconfirmed change past the ancestor limit
+        node = self.nodes[0]
+        for chunk in range(0, count, 500):
+            node.sendmany("", dict((node.getnewaddress(), 1) for i in range(min(500, count - chunk))))
+        node.setgenerate(True, 1)
+
+    def fill_mempool(self, size):
+        node = self.nodes[0]
+        address = node.getnewaddress()
+        while len(node.getrawmempool()) < size:
+            node.sendtoaddress(address, 0.01)
+
+    def time_template(self, size):
+        node = self.nodes[0]
+        elapsed = 0.0
+        ntx = 0
+        for r in range(self.options.rounds):
+            # A new tip makes the next getblocktemplate build a fresh template
+            node.setgenerate(True, 1)
+            self.fill_mempool(size)
+            start = time.time()
+            template = node.getblocktemplate()
+            elapsed += time.time() - start
+            ntx += len(template["transactions"])
+        return (elapsed / self.options.rounds, ntx / self.options.rounds)
+
+    def run_test(self):
+        for size in [int(s) for s in self.options.sizes.split(",")]:
+            elapsed, ntx = self.time_template(size)
+            print("mempool %6d txs: template with %d txs in %.1fms" % (size, ntx, elapsed * 1000))
+
+if __name__ == '__main__':
+    TemplateBenchmark().main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Escrow developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that importing keys rescans the chain on the rescan threads and
+# finds the same transactions whatever the thread count, and that
+# abortrescan and getwalletinfo report on the rescan.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+
+class WalletRescanTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 3)
+
+    def setup_network(self):
+        self.is_network_split = False
+        self.nodes = start_nodes(3, self.options.tmpdir, [[], ["-rescanthreads=1"], ["-rescanthreads=4"]])
+        connect_nodes(self.nodes[1], 0)
+        connect_nodes(self.nodes[2], 0)
+        self.nodes[0].setgenerate(True, 20)
+        sync_blocks(self.nodes)
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.getnewaddress()
+        change = node.getnewaddress()
+        # Payments to the address spread over many blocks, and a spend from it
+        for i in range(20):
+            node.sendtoaddress(address, 1)
+            node.setgenerate(True, 1)
+        utxo = [u for u in node.listunspent() if u["address"] == address][0]
+        rawtx = node.createrawtransaction([{"txid": utxo["txid"], "vout": utxo["vout"]}], {change: 0.9})
+        node.sendrawtransaction(node.signrawtransaction(rawtx)["hex"])
+        node.setgenerate(True, 1)
+        sync_blocks(self.nodes)
+
+        assert_equal(self.nodes[1].getwalletinfo()["scanning"], False)
+        assert_equal(self.nodes[1].abortrescan(), False)
+
+        key = node.dumpprivkey(address)
+        for n in self.nodes[1:]:
+            n.importprivkey(key)
+            assert_equal(n.getbalance(), 19)
+            assert_equal(len(n.listtransactions("*", 100)), 21)
+            assert_equal(n.getwalletinfo()["scanning"], False)
+
+if __name__ == '__main__':
+    WalletRescanTest().main()
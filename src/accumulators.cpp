@@ -10,9 +10,13 @@
 #include "txdb.h"
 #include "init.h"
 #include "spork.h"
+#include "ui_interface.h"
 #include "accumulatorcheckpoints.h"
 #include "zpivchain.h"
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 using namespace libzerocoin;
 
 std::map<uint32_t, CBigNum> mapAccumulatorValues;
@@ -21,7 +25,7 @@ std::list<uint256> listAccCheckpointsNoDB;
 uint32_t ParseChecksum(uint256 nChecksum, CoinDenomination denomination)
 {
     //shift to the beginning bit of this denomination and trim any remaining bits by returning 32 bits only
-    int pos = distance(zerocoinDenomList.begin(), find(zerocoinDenomList.begin(), zerocoinDenomList.end(), denomination));
+    int pos = std::distance(zerocoinDenomList.begin(), find(zerocoinDenomList.begin(), zerocoinDenomList.end(), denomination));
     nChecksum = nChecksum >> (32*((zerocoinDenomList.size() - 1) - pos));
     return nChecksum.Get32();
 }
@@ -268,23 +272,23 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
             continue;
         }
 
-        //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk", __func__);
-
-        std::list<PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins, fFilterInvalid))
-            return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
-
-        nTotalMintsFound += listPubcoins.size();
-        LogPrint("zero", "%s found %d mints\n", __func__, listPubcoins.size());
-
-        //add the pubcoins to accumulator
-        for (const PublicCoin pubcoin : listPubcoins) {
-            if(!mapAccumulators.Accumulate(pubcoin, true))
-                return error("%s: failed to add pubcoin to accumulator at height %d", __func__, pindex->nHeight);
+        //grab mints from this block, using the mint index rather than reading the block
+        int nMintsFound = 0;
+        for (auto denom : zerocoinDenomList) {
+            std::vector<CBigNum> vPubcoins;
+            if (!GetBlockPubcoins(pindex, denom, fFilterInvalid, vPubcoins))
+                return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+            //add the pubcoins to accumulator
+            for (const CBigNum& bnPubcoin : vPubcoins) {
+                if(!mapAccumulators.Accumulate(PublicCoin(Params().Zerocoin_Params(false), bnPubcoin, denom), true))
+                    return error("%s: failed to add pubcoin to accumulator at height %d", __func__, pindex->nHeight);
+            }
+            nMintsFound += vPubcoins.size();
         }
+
+        nTotalMintsFound += nMintsFound;
+        LogPrint("zero", "%s found %d mints\n", __func__, nMintsFound);
         pindex = chainActive.Next(pindex);
     }
 
@@ -298,6 +302,114 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
     return true;
 }
 
+//Add each checkpoint's mints to a single denomination's accumulator, recording the value reached at every checkpoint
+static void AccumulateDenomination(CoinDenomination denom, CBigNum bnValueStart, const std::vector<std::vector<CBigNum> >* pvMints,
+                                   std::vector<CBigNum>* pvValues)
+{
+    RenameThread("escrow-accumulator");
+    Accumulator accumulator(Params().Zerocoin_Params(false), denom, bnValueStart);
+    for (const std::vector<CBigNum>& vMints : *pvMints) {
+        for (const CBigNum& bnPubcoin : vMints)
+            accumulator.increment(bnPubcoin);
+        pvValues->emplace_back(accumulator.getValue());
+    }
+}
+
+//Recalculate and database every checkpoint from nHeightStart to the tip, running each denomination on its own thread
+bool RecalculateAccumulatorCheckpoints(int nHeightStart, std::list<uint256>& listMissingCheckpoints)
+{
+    if (nHeightStart % 10 != 0 || nHeightStart <= GetParallelAccumulatorStartHeight())
+        return error("%s: checkpoint height %d cannot be recalculated in parallel", __func__, nHeightStart);
+
+    int nHeightEnd = chainActive.Height() - chainActive.Height() % 10;
+    if (nHeightEnd < nHeightStart)
+        return true;
+
+    //the previous checkpoint is the starting value of each denomination
+    AccumulatorMap mapAccumulators(Params().Zerocoin_Params(false));
+    int nHeightCheckpoint;
+    if (!InitializeAccumulators(nHeightStart, nHeightCheckpoint, mapAccumulators))
+        return error("%s: failed to initialize accumulators", __func__);
+
+    std::map<CoinDenomination, CBigNum> mapValues;
+    for (auto denom : zerocoinDenomList)
+        mapValues[denom] = mapAccumulators.GetValue(denom);
+
+    const int nCheckpointsTotal = (nHeightEnd - nHeightStart) / 10 + 1;
+    int nCheckpointsDone = 0;
+    int64_t nTimeStart = GetTimeMillis();
+    LogPrintf("%s : recalculating %d checkpoints from height %d to %d\n", __func__, nCheckpointsTotal, nHeightStart, nHeightEnd);
+
+    for (int nHeightBatch = nHeightStart; nHeightBatch <= nHeightEnd; nHeightBatch += 10 * ACCUMULATOR_REINDEX_BATCH_SIZE) {
+        if (ShutdownRequested())
+            return false;
+
+        int nHeightBatchEnd = std::min(nHeightEnd, nHeightBatch + 10 * (ACCUMULATOR_REINDEX_BATCH_SIZE - 1));
+        int nCheckpoints = (nHeightBatchEnd - nHeightBatch) / 10 + 1;
+
+        //prefetch the mints each checkpoint adds (height - 20 through height - 11) so the worker threads never touch the chain
+        std::map<CoinDenomination, std::vector<std::vector<CBigNum> > > mapMints;
+        for (auto denom : zerocoinDenomList)
+            mapMints[denom].resize(nCheckpoints);
+        for (int i = 0; i < nCheckpoints; i++) {
+            int nHeight = nHeightBatch + 10 * i;
+            for (int nHeightBlock = nHeight - 20; nHeightBlock < nHeight - 10; nHeightBlock++) {
+                for (auto denom : zerocoinDenomList) {
+                    std::vector<CBigNum> vPubcoins;
+                    if (!GetBlockPubcoins(chainActive[nHeightBlock], denom, true, vPubcoins))
+                        return error("%s: failed to get zerocoin mintlist from block %d", __func__, nHeightBlock);
+                    std::vector<CBigNum>& vMints = mapMints.at(denom)[i];
+                    vMints.insert(vMints.end(), vPubcoins.begin(), vPubcoins.end());
+                }
+            }
+        }
+
+        std::map<CoinDenomination, std::vector<CBigNum> > mapCheckpointValues;
+        boost::thread_group threadGroup;
+        for (auto denom : zerocoinDenomList) {
+            mapCheckpointValues[denom].reserve(nCheckpoints);
+            threadGroup.create_thread(boost::bind(&AccumulateDenomination, denom, mapValues.at(denom), &mapMints.at(denom),
+                                                  &mapCheckpointValues.at(denom)));
+        }
+        threadGroup.join_all();
+
+        //check each calculated checkpoint against the block index before databasing it
+        for (int i = 0; i < nCheckpoints; i++) {
+            int nHeight = nHeightBatch + 10 * i;
+            AccumulatorCheckpoints::Checkpoint checkpoint;
+            for (auto denom : zerocoinDenomList)
+                checkpoint[denom] = mapCheckpointValues.at(denom)[i];
+            mapAccumulators.Load(checkpoint);
+
+            uint256 nCheckpointCalculated = mapAccumulators.GetCheckpoint();
+            uint256 nCheckpointIndex = chainActive[nHeight]->nAccumulatorCheckpoint;
+            if (nCheckpointCalculated != nCheckpointIndex)
+                return error("%s : height=%d calculated_checkpoint=%s actual=%s", __func__, nHeight, nCheckpointCalculated.GetHex(), nCheckpointIndex.GetHex());
+
+            DatabaseChecksums(mapAccumulators);
+            listMissingCheckpoints.remove(nCheckpointIndex);
+        }
+
+        for (auto denom : zerocoinDenomList)
+            mapValues[denom] = mapCheckpointValues.at(denom).back();
+
+        nCheckpointsDone += nCheckpoints;
+        int64_t nTimeElapsed = GetTimeMillis() - nTimeStart;
+        int64_t nTimeRemaining = nTimeElapsed * (nCheckpointsTotal - nCheckpointsDone) / nCheckpointsDone;
+        uiInterface.ShowProgress(_("Calculating missing accumulators..."), std::max(1, std::min(99, nCheckpointsDone * 100 / nCheckpointsTotal)));
+        LogPrintf("%s : %d/%d checkpoints done, height=%d elapsed=%ds remaining=~%ds\n", __func__, nCheckpointsDone, nCheckpointsTotal,
+                  nHeightBatchEnd, nTimeElapsed / 1000, nTimeRemaining / 1000);
+    }
+
+    return true;
+}
+
+int GetParallelAccumulatorStartHeight()
+{
+    //checkpoints at or below these heights are reset from hard checkpoints or a recalculation and are never chained from the previous one
+    return std::max(Params().Zerocoin_Block_V2_Start() + 20, Params().Zerocoin_Block_RecalculateAccumulators());
+}
+
 bool InvalidCheckpointRange(int nHeight)
 {
     return nHeight > Params().Zerocoin_Block_LastGoodCheckpoint() && nHeight < Params().Zerocoin_Block_RecalculateAccumulators();
@@ -348,14 +460,11 @@ void RandomizeSecurityLevel(int& nSecurityLevel)
 //Compute how many coins were added to an accumulator up to the end height
 int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
 {
-    CBlockIndex* pindex = chainActive[GetZerocoinStartHeight()];
-    int n = 0;
-    while (pindex->nHeight < nHeightEnd) {
-        n += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-        pindex = chainActive.Next(pindex);
-    }
+    if (nHeightEnd <= GetZerocoinStartHeight())
+        return 0;
 
-    return n;
+    CBlockIndex* pindex = chainActive[std::min(nHeightEnd - 1, chainActive.Height())];
+    return pindex->GetZerocoinMintCount(denom);
 }
 
 int AddBlockMintsToAccumulator(const libzerocoin::PublicCoin& coin, const int nHeightMintAdded, const CBlockIndex* pindex,
@@ -365,23 +474,16 @@ int AddBlockMintsToAccumulator(const libzerocoin::PublicCoin& coin, const int nH
     int nMintsAdded = 0;
     if (pindex->MintedDenomination(coin.getDenomination())) {
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk while adding pubcoins to witness", __func__);
-
-        list<PublicCoin> listPubcoins;
-        if(!BlockToPubcoinList(block, listPubcoins, true))
-            return error("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
+        std::vector<CBigNum> vPubcoins;
+        if(!GetBlockPubcoins(pindex, coin.getDenomination(), true, vPubcoins))
+            return error("%s: failed to get zerocoin mintlist from block %d\n", __func__, pindex->nHeight);
 
         //add the mints to the witness
-        for (const PublicCoin& pubcoin : listPubcoins) {
-            if (pubcoin.getDenomination() != coin.getDenomination())
+        for (const CBigNum& bnPubcoin : vPubcoins) {
+            if (isWitness && pindex->nHeight == nHeightMintAdded && bnPubcoin == coin.getValue())
                 continue;
 
-            if (isWitness && pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                continue;
-
-            accumulator->increment(pubcoin.getValue());
+            accumulator->increment(bnPubcoin);
             ++nMintsAdded;
         }
     }
@@ -415,22 +517,42 @@ bool GetAccumulatorValue(int& nHeight, const libzerocoin::CoinDenomination denom
     return true;
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CBlockIndex* pindexCheckpoint)
+void CMintWitness::Add(const CWitnessProgress& progress)
 {
-    LogPrint("zero", "%s: generating\n", __func__);
-    int nLockAttempts = 0;
-    while (nLockAttempts < 100) {
-        TRY_LOCK(cs_main, lockMain);
-        if(!lockMain) {
-            MilliSleep(50);
-            nLockAttempts++;
-            continue;
-        }
-        break;
+    std::list<CWitnessProgress>::iterator it = listProgress.begin();
+    while (it != listProgress.end() && it->nHeightNext > progress.nHeightNext)
+        ++it;
+    if (it != listProgress.end() && it->nHeightNext == progress.nHeightNext)
+        it = listProgress.erase(it);
+    listProgress.insert(it, progress);
+
+    while (listProgress.size() > MAX_PROGRESS)
+        listProgress.pop_back();
+}
+
+//Drop any state that was computed on blocks no longer in the active chain
+void CMintWitness::Rewind()
+{
+    AssertLockHeld(cs_main);
+    std::list<CWitnessProgress>::iterator it = listProgress.begin();
+    while (it != listProgress.end()) {
+        CBlockIndex* pindexLast = chainActive[it->nHeightNext - 1];
+        if (!pindexLast || pindexLast->GetBlockHash() != it->hashBlockLast)
+            it = listProgress.erase(it);
+        else
+            ++it;
     }
-    if (nLockAttempts == 100)
-        return error("%s: could not get lock on cs_main", __func__);
-    LogPrint("zero", "%s: after lock\n", __func__);
+}
+
+//The height a full security level witness stops at: at least two checkpoints deep
+int GetWitnessStopHeight(int nChainHeight)
+{
+    return nChainHeight - (nChainHeight % 10) - 20;
+}
+
+//Find the block a mint was added in, the checkpoint that follows it and the height its witness starts accumulating at
+static bool GetWitnessStartHeights(const PublicCoin& coin, int& nHeightMintAdded, int& nHeightCheckpoint, int& nAccStartHeight)
+{
     uint256 txid;
     if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid))
         return error("%s failed to read mint from db", __func__);
@@ -444,13 +566,125 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     if (!IsTransactionInChain(txid, nHeightTest))
         return error("%s: mint tx %s is not in chain", __func__, txid.GetHex());
 
-    int nHeightMintAdded = mapBlockIndex[hashBlock]->nHeight;
+    nHeightMintAdded = mapBlockIndex[hashBlock]->nHeight;
 
     //get the checkpoint added at the next multiple of 10
-    int nHeightCheckpoint = nHeightMintAdded + (10 - (nHeightMintAdded % 10));
+    nHeightCheckpoint = nHeightMintAdded + (10 - (nHeightMintAdded % 10));
 
     //the height to start accumulating coins to add to witness
-    int nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
+    nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
+
+    return true;
+}
+
+//Start the witness of a confirmed mint from the accumulator before it, so it can be advanced before the mint is first spent
+bool InitAccumulatorWitness(const PublicCoin& coin, CMintWitness& mintWitness)
+{
+    LOCK(cs_main);
+    int nHeightMintAdded, nHeightCheckpoint, nAccStartHeight;
+    if (!GetWitnessStartHeights(coin, nHeightMintAdded, nHeightCheckpoint, nAccStartHeight))
+        return false;
+
+    CBigNum bnAccValue = 0;
+    if (!GetAccumulatorValue(nHeightCheckpoint, coin.getDenomination(), bnAccValue))
+        return error("%s: failed to get the accumulator value at height %d", __func__, nHeightCheckpoint);
+
+    CBlockIndex* pindexLast = chainActive[nHeightCheckpoint - 11];
+    if (!pindexLast)
+        return false;
+
+    mintWitness = CMintWitness();
+    mintWitness.bnPubcoin = coin.getValue();
+    mintWitness.denom = coin.getDenomination();
+    mintWitness.nHeightMintAdded = nHeightMintAdded;
+    mintWitness.nAccStartHeight = nAccStartHeight;
+
+    CWitnessProgress progress;
+    progress.nHeightNext = nHeightCheckpoint - 10;
+    progress.hashBlockLast = pindexLast->GetBlockHash();
+    progress.bnWitness = bnAccValue;
+    mintWitness.Add(progress);
+
+    return true;
+}
+
+//Add the blocks from the newest witness state up to (not including) nHeightStop
+bool AdvanceAccumulatorWitness(CMintWitness& mintWitness, int nHeightStop)
+{
+    CWitnessProgress progress;
+    std::vector<const CBlockIndex*> vBlocks;
+    const CBlockIndex* pindexNext;
+    bool fDoubleCounted;
+    {
+        // cs_main is only needed to find the blocks, reading and accumulating their mints runs without it
+        LOCK(cs_main);
+        mintWitness.Rewind();
+        if (mintWitness.listProgress.empty())
+            return false;
+
+        progress = mintWitness.listProgress.front();
+        if (progress.nHeightNext >= nHeightStop)
+            return true;
+
+        fDoubleCounted = progress.fDoubleCounted;
+        CBlockIndex* pindex = chainActive[progress.nHeightNext];
+        while (pindex && pindex->nHeight < nHeightStop) {
+            vBlocks.push_back(pindex);
+
+            // 10 blocks were accumulated twice when zESCO v2 was activated
+            if (pindex->nHeight == 1050010 && !fDoubleCounted) {
+                pindex = chainActive[1050000];
+                fDoubleCounted = true;
+                continue;
+            }
+
+            pindex = chainActive.Next(pindex);
+        }
+
+        if (!pindex)
+            return false;
+        pindexNext = pindex;
+    }
+
+    // A reorg meanwhile is caught by the Rewind of the next call, the block indexes themselves stay valid
+    PublicCoin coin(Params().Zerocoin_Params(false), mintWitness.bnPubcoin, mintWitness.denom);
+    Accumulator witnessAccumulator(Params().Zerocoin_Params(false), mintWitness.denom, progress.bnWitness);
+    for (const CBlockIndex* pindex : vBlocks) {
+        if (pindex->nHeight != mintWitness.nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
+            ++progress.nCheckpointsAdded;
+
+        progress.nMintsAdded += AddBlockMintsToAccumulator(coin, mintWitness.nHeightMintAdded, pindex, &witnessAccumulator, true);
+    }
+
+    progress.fDoubleCounted = fDoubleCounted;
+    progress.nHeightNext = pindexNext->nHeight;
+    progress.hashBlockLast = pindexNext->pprev->GetBlockHash();
+    progress.bnWitness = witnessAccumulator.getValue();
+    mintWitness.Add(progress);
+    LogPrint("zero", "%s: advanced witness of %s to height %d\n", __func__, mintWitness.bnPubcoin.GetHex().substr(0, 10), progress.nHeightNext);
+
+    return true;
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CBlockIndex* pindexCheckpoint, CMintWitness* pmintWitness)
+{
+    LogPrint("zero", "%s: generating\n", __func__);
+    int nLockAttempts = 0;
+    while (nLockAttempts < 100) {
+        TRY_LOCK(cs_main, lockMain);
+        if(!lockMain) {
+            MilliSleep(50);
+            nLockAttempts++;
+            continue;
+        }
+        break;
+    }
+    if (nLockAttempts == 100)
+        return error("%s: could not get lock on cs_main", __func__);
+    LogPrint("zero", "%s: after lock\n", __func__);
+    int nHeightMintAdded, nHeightCheckpoint, nAccStartHeight;
+    if (!GetWitnessStartHeights(coin, nHeightMintAdded, nHeightCheckpoint, nAccStartHeight))
+        return false;
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
     CBigNum bnAccValue = 0;
@@ -462,9 +696,7 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     //add the pubcoins from the blockchain up to the next checksum starting from the block
     if (nHeightCheckpoint < 10) nHeightCheckpoint = 10;
     CBlockIndex* pindex = chainActive[nHeightCheckpoint - 10];
-    int nChainHeight = chainActive.Height();
-    int nHeightStop = nChainHeight % 10;
-    nHeightStop = nChainHeight - nHeightStop - 20; // at least two checkpoints deep
+    int nHeightStop = GetWitnessStopHeight(chainActive.Height());
 
     //If looking for a specific checkpoint
     if (pindexCheckpoint)
@@ -477,8 +709,41 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     libzerocoin::Accumulator witnessAccumulator = accumulator;
 
     bool fDoubleCounted = false;
+
+    //Resume from an earlier computation for this mint if it did not go past where this witness stops
+    if (pmintWitness) {
+        if (pmintWitness->bnPubcoin != coin.getValue() || pmintWitness->nHeightMintAdded != nHeightMintAdded) {
+            *pmintWitness = CMintWitness();
+            pmintWitness->bnPubcoin = coin.getValue();
+            pmintWitness->denom = coin.getDenomination();
+            pmintWitness->nHeightMintAdded = nHeightMintAdded;
+            pmintWitness->nAccStartHeight = nAccStartHeight;
+        }
+
+        {
+            LOCK(cs_main);
+            pmintWitness->Rewind();
+        }
+        for (const CWitnessProgress& progress : pmintWitness->listProgress) {
+            if (progress.nHeightNext - 1 >= nHeightStop || (nSecurityLevel != 100 && progress.nCheckpointsAdded >= nSecurityLevel))
+                continue;
+            if (progress.fDoubleCounted && progress.nHeightNext <= 1050010)
+                continue;
+
+            pindex = chainActive[progress.nHeightNext];
+            witnessAccumulator.setValue(progress.bnWitness);
+            nMintsAdded = progress.nMintsAdded;
+            nCheckpointsAdded = progress.nCheckpointsAdded;
+            fDoubleCounted = progress.fDoubleCounted;
+            LogPrint("zero", "%s: resuming witness from height %d\n", __func__, progress.nHeightNext);
+            break;
+        }
+    }
+
+    CWitnessProgress progressStop;
     while (pindex) {
-        if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
+        bool fNewCheckpoint = pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint;
+        if (fNewCheckpoint)
             ++nCheckpointsAdded;
 
         //If the security level is satisfied, or the stop height is reached, then initialize the accumulator from here
@@ -494,6 +759,14 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
                 return error("%s : failed to find checksum in database for accumulator", __func__);
 
             accumulator.setValue(bnAccValue);
+
+            //remember how far this witness got, before this block was counted
+            progressStop.nHeightNext = pindex->nHeight;
+            progressStop.hashBlockLast = pindex->pprev->GetBlockHash();
+            progressStop.bnWitness = witnessAccumulator.getValue();
+            progressStop.nMintsAdded = nMintsAdded;
+            progressStop.nCheckpointsAdded = nCheckpointsAdded - (fNewCheckpoint ? 1 : 0);
+            progressStop.fDoubleCounted = fDoubleCounted;
             break;
         }
 
@@ -513,6 +786,9 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     if (!witness.VerifyWitness(accumulator, coin))
         return error("%s: failed to verify witness", __func__);
 
+    if (pmintWitness && progressStop.nHeightNext > 0)
+        pmintWitness->Add(progressStop);
+
     // A certain amount of accumulated coins are required
     if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
         strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
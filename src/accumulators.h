@@ -14,14 +14,85 @@
 #include "chain.h"
 #include "uint256.h"
 
+#include <list>
+
 class CBlockIndex;
 
+//! number of checkpoints recalculated between database writes and progress reports
+static const int ACCUMULATOR_REINDEX_BATCH_SIZE = 1000;
+//! number of missing checkpoints above which they are recalculated in parallel instead of one at a time
+static const unsigned int ACCUMULATOR_REINDEX_PARALLEL_MIN = 100;
+
+/** State of a witness computation after all blocks below nHeightNext were added to it */
+struct CWitnessProgress
+{
+    int nHeightNext;
+    uint256 hashBlockLast; //hash of the block at nHeightNext - 1, used to detect reorgs
+    CBigNum bnWitness;
+    int nMintsAdded;
+    int nCheckpointsAdded;
+    bool fDoubleCounted;
+
+    CWitnessProgress() : nHeightNext(0), hashBlockLast(0), bnWitness(0), nMintsAdded(0), nCheckpointsAdded(0), fDoubleCounted(false) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nHeightNext);
+        READWRITE(hashBlockLast);
+        READWRITE(bnWitness);
+        READWRITE(nMintsAdded);
+        READWRITE(nCheckpointsAdded);
+        READWRITE(fDoubleCounted);
+    }
+};
+
+/** Witness computations already done for a mint, so they can be resumed instead of started over from the mint's checkpoint */
+class CMintWitness
+{
+public:
+    //! number of earlier states kept, allowing witnesses for older checkpoints and rewinding after a reorg
+    static const unsigned int MAX_PROGRESS = 10;
+
+    CBigNum bnPubcoin;
+    libzerocoin::CoinDenomination denom;
+    int nHeightMintAdded;
+    int nAccStartHeight;
+    //! newest first
+    std::list<CWitnessProgress> listProgress;
+
+    CMintWitness() : bnPubcoin(0), denom(libzerocoin::ZQ_ERROR), nHeightMintAdded(0), nAccStartHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(bnPubcoin);
+        READWRITE(denom);
+        READWRITE(nHeightMintAdded);
+        READWRITE(nAccStartHeight);
+        std::vector<CWitnessProgress> vProgress(listProgress.begin(), listProgress.end());
+        READWRITE(vProgress);
+        if (ser_action.ForRead())
+            listProgress.assign(vProgress.begin(), vProgress.end());
+    }
+
+    void Add(const CWitnessProgress& progress);
+    void Rewind();
+};
+
 std::map<libzerocoin::CoinDenomination, int> GetMintMaturityHeight();
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr);
+bool InitAccumulatorWitness(const libzerocoin::PublicCoin& coin, CMintWitness& mintWitness);
+bool AdvanceAccumulatorWitness(CMintWitness& mintWitness, int nHeightStop);
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr, CMintWitness* pmintWitness = nullptr);
+int GetWitnessStopHeight(int nChainHeight);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
 bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators);
+bool RecalculateAccumulatorCheckpoints(int nHeightStart, std::list<uint256>& listMissingCheckpoints);
+int GetParallelAccumulatorStartHeight();
 void DatabaseChecksums(AccumulatorMap& mapAccumulators);
 bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint);
 bool EraseAccumulatorValues(const uint256& nCheckpointErase, const uint256& nCheckpointPrevious);
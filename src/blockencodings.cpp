@@ -0,0 +1,164 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "random.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <boost/unordered_map.hpp>
+
+//! A transaction is at least this many bytes, which bounds the number of transactions in a block
+static const unsigned int MIN_TRANSACTION_SIZE = 60;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) : nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+                                                                            header(block.GetBlockHeader()),
+                                                                            vchBlockSig(block.vchBlockSig)
+{
+    FillShortTxIDSelector();
+
+    // The coinbase and coinstake are never in the receiver's mempool
+    size_t nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    prefilledtxn.resize(std::min(nPrefilled, block.vtx.size()));
+    for (size_t i = 0; i < prefilledtxn.size(); i++) {
+        prefilledtxn[i].index = i;
+        prefilledtxn[i].tx = block.vtx[i];
+    }
+
+    shorttxids.reserve(block.vtx.size() - prefilledtxn.size());
+    for (size_t i = prefilledtxn.size(); i < block.vtx.size(); i++)
+        shorttxids.push_back(GetShortID(block.vtx[i].GetHash()));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CHashWriter ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header << nonce;
+    uint256 hashSelector = ss.GetHash();
+    shorttxidk0 = ReadLE64(hashSelector.begin());
+    shorttxidk1 = ReadLE64(hashSelector.begin() + 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffULL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_BLOCK_SIZE_CURRENT / MIN_TRANSACTION_SIZE)
+        return READ_STATUS_INVALID;
+
+    assert(header.IsNull() && txn_available.empty());
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+    txn_available.resize(cmpctblock.BlockTxCount());
+    have_txn.assign(cmpctblock.BlockTxCount(), false);
+
+    // Prefilled indexes must be strictly increasing and inside the block
+    int nLastIndex = -1;
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        const PrefilledTransaction& prefilled = cmpctblock.prefilledtxn[i];
+        if (prefilled.tx.IsNull() || (int)prefilled.index <= nLastIndex || prefilled.index >= txn_available.size())
+            return READ_STATUS_INVALID;
+        nLastIndex = prefilled.index;
+        txn_available[prefilled.index] = prefilled.tx;
+        have_txn[prefilled.index] = true;
+    }
+    prefilled_count = cmpctblock.prefilledtxn.size();
+
+    // Map each short ID to its position in the block, skipping prefilled slots
+    boost::unordered_map<uint64_t, uint16_t> mapShortIDs;
+    mapShortIDs.rehash(cmpctblock.shorttxids.size());
+    uint16_t nIndex = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (have_txn[nIndex])
+            nIndex++;
+        mapShortIDs[cmpctblock.shorttxids[i]] = nIndex;
+        nIndex++;
+    }
+    // Two transactions of the same block share a short ID; this is rare
+    // enough (or the sender is messing with us) to just get the full block.
+    if (mapShortIDs.size() != cmpctblock.shorttxids.size())
+        return READ_STATUS_FAILED;
+
+    std::vector<bool> have_collision(txn_available.size(), false);
+    {
+        LOCK(pool->cs);
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = pool->mapTx.begin(); it != pool->mapTx.end(); ++it) {
+            boost::unordered_map<uint64_t, uint16_t>::const_iterator idit = mapShortIDs.find(cmpctblock.GetShortID(it->first));
+            if (idit == mapShortIDs.end())
+                continue;
+            if (!have_txn[idit->second]) {
+                if (!have_collision[idit->second]) {
+                    txn_available[idit->second] = it->second.GetTx();
+                    have_txn[idit->second] = true;
+                    mempool_count++;
+                }
+            } else if (!have_collision[idit->second]) {
+                // Two mempool transactions match this short ID, we cannot tell
+                // which one the block has, so request it from the peer.
+                txn_available[idit->second] = CTransaction();
+                have_txn[idit->second] = false;
+                have_collision[idit->second] = true;
+                mempool_count--;
+            }
+            if (mempool_count == mapShortIDs.size())
+                break;
+        }
+    }
+
+    LogPrint("net", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n",
+        cmpctblock.header.GetHash().ToString(), cmpctblock.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
+
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(!header.IsNull());
+    assert(index < have_txn.size());
+    return have_txn[index];
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const
+{
+    assert(!header.IsNull());
+    block = header;
+    block.vtx.resize(txn_available.size());
+
+    size_t nMissing = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (have_txn[i]) {
+            block.vtx[i] = txn_available[i];
+        } else {
+            if (nMissing >= vtx_missing.size())
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtx_missing[nMissing++];
+        }
+    }
+    if (nMissing != vtx_missing.size())
+        return READ_STATUS_INVALID;
+
+    if (block.IsProofOfStake())
+        block.vchBlockSig = vchBlockSig;
+
+    // A wrong transaction only gets here through a short ID collision with a
+    // mempool transaction (or a peer lying about the block), either way the
+    // full block sorts it out.
+    bool fMutated = false;
+    if (block.BuildMerkleTree(&fMutated) != header.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    LogPrint("net", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n",
+        header.GetHash().ToString(), prefilled_count, mempool_count, vtx_missing.size());
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+class CTxMemPool;
+
+//! Short transaction IDs are the low 48 bits of a keyed SipHash of the txid
+static const unsigned int SHORTTXIDS_LENGTH = 6;
+
+//! Blocks deeper than this below the tip are served in full instead of as compact blocks
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+
+/** Transactions requested by "getblocktxn", by their index in the block */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(indexes);
+    }
+};
+
+/** Reply to a "getblocktxn", the requested transactions in request order */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/** A transaction sent in full inside a compact block, with its index in the block */
+struct PrefilledTransaction {
+    uint16_t index;
+    CTransaction tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        uint64_t nIndex = index;
+        READWRITE(VARINT(nIndex));
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("index overflowed 16 bits");
+        index = nIndex;
+        READWRITE(tx);
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! Invalid object, peer is sending bogus data
+    READ_STATUS_FAILED,  //! Failed to process object (short ID collision), fetch the full block
+};
+
+/**
+ * A block announced as its header plus a 6 byte short ID per transaction.
+ * The coinbase and, for proof-of-stake blocks, the coinstake are always sent
+ * in full along with the block signature, so the receiver only needs its
+ * mempool to fill in the rest.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+    friend class PartiallyDownloadedBlock;
+
+protected:
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    // Dummy for deserialization
+    CBlockHeaderAndShortTxIDs() {}
+
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return ::GetSerializeSize(header, nType, nVersion) + sizeof(nonce) +
+               GetSizeOfCompactSize(shorttxids.size()) + shorttxids.size() * SHORTTXIDS_LENGTH +
+               ::GetSerializeSize(prefilledtxn, nType, nVersion) + ::GetSerializeSize(vchBlockSig, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, header, nType, nVersion);
+        ::Serialize(s, nonce, nType, nVersion);
+        WriteCompactSize(s, shorttxids.size());
+        for (std::vector<uint64_t>::const_iterator it = shorttxids.begin(); it != shorttxids.end(); ++it) {
+            uint32_t lsb = *it & 0xffffffff;
+            uint16_t msb = (*it >> 32) & 0xffff;
+            ::Serialize(s, lsb, nType, nVersion);
+            ::Serialize(s, msb, nType, nVersion);
+        }
+        ::Serialize(s, prefilledtxn, nType, nVersion);
+        ::Serialize(s, vchBlockSig, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, header, nType, nVersion);
+        ::Unserialize(s, nonce, nType, nVersion);
+        uint64_t nShortTxIDs = ReadCompactSize(s);
+        shorttxids.clear();
+        // Don't trust the announced count for the allocation, grow as the data arrives
+        shorttxids.reserve(std::min<uint64_t>(nShortTxIDs, 1000));
+        for (uint64_t i = 0; i < nShortTxIDs; i++) {
+            uint32_t lsb;
+            uint16_t msb;
+            ::Unserialize(s, lsb, nType, nVersion);
+            ::Unserialize(s, msb, nType, nVersion);
+            shorttxids.push_back((uint64_t(msb) << 32) | uint64_t(lsb));
+        }
+        ::Unserialize(s, prefilledtxn, nType, nVersion);
+        ::Unserialize(s, vchBlockSig, nType, nVersion);
+        FillShortTxIDSelector();
+    }
+};
+
+/** Block reconstruction state while waiting for the transactions we could not find locally */
+class PartiallyDownloadedBlock
+{
+protected:
+    std::vector<CTransaction> txn_available;
+    std::vector<bool> have_txn;
+    size_t prefilled_count, mempool_count;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    PartiallyDownloadedBlock(CTxMemPool* poolIn) : prefilled_count(0), mempool_count(0), pool(poolIn) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
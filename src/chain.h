@@ -99,6 +99,8 @@ enum BlockStatus {
     BLOCK_FAILED_VALID = 32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD = 64, //! descends from failed block
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_HAVE_MINT_COUNT = 128, //! cumulative zerocoin mint counts recorded (older entries lack them)
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -182,6 +184,8 @@ public:
     //! zerocoin specific fields
     std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
     std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    //! cumulative count of mints of each denomination up to and including this block (empty until computed)
+    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinMintCount;
     
     void SetNull()
     {
@@ -217,6 +221,7 @@ public:
             mapZerocoinSupply.insert(make_pair(denom, 0));
         }
         vMintDenominationsInBlock.clear();
+        mapZerocoinMintCount.clear();
     }
 
     CBlockIndex()
@@ -304,6 +309,24 @@ public:
         return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
     }
 
+    /** Number of mints of a denomination from the start of the chain up to and including this block */
+    int64_t GetZerocoinMintCount(libzerocoin::CoinDenomination denom) const
+    {
+        std::map<libzerocoin::CoinDenomination, int64_t>::const_iterator it = mapZerocoinMintCount.find(denom);
+        return it == mapZerocoinMintCount.end() ? 0 : it->second;
+    }
+
+    /** Set the cumulative mint counts from the previous block's and this block's mints */
+    void SetZerocoinMintCount()
+    {
+        mapZerocoinMintCount.clear();
+        for (auto& denom : libzerocoin::zerocoinDenomList) {
+            int64_t nCount = pprev ? pprev->GetZerocoinMintCount(denom) : 0;
+            mapZerocoinMintCount.insert(make_pair(denom, nCount + std::count(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom)));
+        }
+        nStatus |= BLOCK_HAVE_MINT_COUNT;
+    }
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -483,6 +506,9 @@ public:
             READWRITE(mapZerocoinSupply);
             READWRITE(vMintDenominationsInBlock);
         }
+        // Added later: entries written before have no counts and are backfilled when the index is loaded
+        if (nStatus & BLOCK_HAVE_MINT_COUNT)
+            READWRITE(mapZerocoinMintCount);
 
     }
 
@@ -386,6 +386,7 @@ public:
         fRequireStandard = false;
         fMineBlocksOnDemand = true;
         fTestnetToBeDeprecatedFieldRPC = false;
+        fHeadersFirstSyncingActive = true;
     }
     const Checkpoints::CCheckpointData& Checkpoints() const
     {
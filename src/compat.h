@@ -94,6 +94,12 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+#ifdef HAVE_SYS_EPOLL_H
+// Peer sockets are serviced with epoll and single sockets waited on with poll(),
+// neither of which limits descriptors to FD_SETSIZE
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s)
 {
 #ifdef WIN32
@@ -5,8 +5,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -244,9 +247,57 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
+CStakeModifierCache stakeModifierCache;
+
+uint64_t CStakeModifierCache::GetGeneration()
+{
+    LOCK(cs_modifiercache);
+    return nGeneration;
+}
+
+bool CStakeModifierCache::Get(const uint256& hashBlockFrom, CEntry& entry)
+{
+    LOCK(cs_modifiercache);
+    if (cache.get(hashBlockFrom, entry)) {
+        nHits++;
+        return true;
+    }
+    nMisses++;
+    return false;
+}
+
+void CStakeModifierCache::Set(const uint256& hashBlockFrom, const CEntry& entry, uint64_t nGenerationResolved)
+{
+    LOCK(cs_modifiercache);
+    if (nGenerationResolved == nGeneration)
+        cache.insert(hashBlockFrom, entry);
+}
+
+void CStakeModifierCache::Clear()
+{
+    LOCK(cs_modifiercache);
+    cache.clear();
+    nGeneration++;
+}
+
+size_t CStakeModifierCache::Size()
+{
+    LOCK(cs_modifiercache);
+    return cache.size();
+}
+
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
+    uint64_t nCacheGeneration = stakeModifierCache.GetGeneration();
+    CStakeModifierCache::CEntry entry;
+    if (stakeModifierCache.Get(hashBlockFrom, entry)) {
+        nStakeModifier = entry.nStakeModifier;
+        nStakeModifierHeight = entry.nStakeModifierHeight;
+        nStakeModifierTime = entry.nStakeModifierTime;
+        return true;
+    }
+
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
     const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
@@ -271,6 +322,11 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    entry.nStakeModifier = nStakeModifier;
+    entry.nStakeModifierHeight = nStakeModifierHeight;
+    entry.nStakeModifierTime = nStakeModifierTime;
+    stakeModifierCache.Set(hashBlockFrom, entry, nCacheGeneration);
     return true;
 }
 
@@ -343,6 +399,115 @@ bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockF
     return fSuccess;
 }
 
+CStakeKernelSearch::CStakeKernelSearch(unsigned int nBits)
+{
+    bnTargetPerCoinDay.SetCompact(nBits);
+}
+
+bool CStakeKernelSearch::AddInput(CStakeInput* stakeInput)
+{
+    CBlockIndex* pindexFrom = stakeInput->GetIndexFrom();
+    if (!pindexFrom || pindexFrom->nHeight < 1)
+        return false;
+
+    uint64_t nStakeModifier = 0;
+    if (!stakeInput->GetModifier(nStakeModifier))
+        return error("%s : failed to get kernel stake modifier", __func__);
+
+    CKernelInput input;
+    input.stakeInput = stakeInput;
+    input.nValueIn = stakeInput->GetValue();
+    input.nTimeBlockFrom = pindexFrom->GetBlockTime();
+
+    //same serialization as CheckStake(), minus the trailing nTimeTx
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << input.nTimeBlockFrom << stakeInput->GetUniqueness();
+    input.hasherPrefix.Write((const unsigned char*)&ss[0], ss.size());
+
+    vInputs.push_back(input);
+    return true;
+}
+
+bool CStakeKernelSearch::SearchInput(const CKernelInput& input, unsigned int nTimeTx, unsigned int& nTimeFound, uint256& hashProofOfStake) const
+{
+    if (nTimeTx < input.nTimeBlockFrom || input.nTimeBlockFrom + nStakeMinAge > nTimeTx)
+        return false;
+
+    int nHashDrift = 30;
+    unsigned char vchTime[4];
+    for (int i = 0; i < nHashDrift; i++) {
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        WriteLE32(vchTime, nTryTime);
+
+        CHash256 hasher = input.hasherPrefix;
+        hasher.Write(vchTime, sizeof(vchTime)).Finalize((unsigned char*)&hashProofOfStake);
+        if (stakeTargetHit(hashProofOfStake, input.nValueIn, bnTargetPerCoinDay)) {
+            nTimeFound = nTryTime;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CStakeKernelSearch::SearchThread(unsigned int nTimeTx, int nHeightStart, size_t* pnNext, size_t* pnFound, boost::mutex* pmutex) const
+{
+    //inputs are handed out in order, so once an input hits every input before it has been or is being searched
+    while (true) {
+        size_t n;
+        {
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            n = (*pnNext)++;
+            if (n >= vInputs.size() || n >= *pnFound)
+                return;
+        }
+
+        //new block came in, move on
+        if (chainActive.Height() != nHeightStart)
+            return;
+
+        unsigned int nTimeFound;
+        uint256 hashProofOfStake;
+        if (SearchInput(vInputs[n], nTimeTx, nTimeFound, hashProofOfStake)) {
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            *pnFound = std::min(*pnFound, n);
+            return;
+        }
+    }
+}
+
+bool CStakeKernelSearch::Search(size_t nStart, unsigned int nTimeTx, size_t& nInputFound, unsigned int& nTimeFound, uint256& hashProofOfStake) const
+{
+    int nHeightStart = chainActive.Height();
+    size_t nFound = vInputs.size();
+    if (nStart < vInputs.size()) {
+        int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_SEARCH_THREADS);
+        if (nThreads <= 0)
+            nThreads += boost::thread::hardware_concurrency();
+        nThreads = std::max(1, std::min(nThreads, (int)((vInputs.size() - nStart) / STAKE_SEARCH_MIN_INPUTS_PER_THREAD)));
+
+        size_t nNext = nStart;
+        boost::mutex mutex;
+        if (nThreads == 1) {
+            SearchThread(nTimeTx, nHeightStart, &nNext, &nFound, &mutex);
+        } else {
+            boost::thread_group threadGroup;
+            for (int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&CStakeKernelSearch::SearchThread, this, nTimeTx, nHeightStart, &nNext, &nFound, &mutex));
+            threadGroup.join_all();
+        }
+    }
+
+    mapHashedBlocks.clear();
+    mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+
+    if (nFound >= vInputs.size())
+        return false;
+
+    //redo the winning input's hashes to recover its time and proof
+    nInputFound = nFound;
+    return SearchInput(vInputs[nFound], nTimeTx, nTimeFound, hashProofOfStake);
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::unique_ptr<CStakeInput>& stake)
 {
@@ -362,29 +527,36 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
         stake = std::unique_ptr<CStakeInput>(new CZPivStake(spend));
     } else {
         // First try finding the previous transaction in database
+        std::unique_ptr<CPivStake> pivInput(new CPivStake());
+        CScript scriptPubKeyPrev;
         uint256 hashBlock;
         CTransaction txPrev;
-        if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-            return error("CheckProofOfStake() : INFO: read txPrev failed");
+        if (GetTransaction(txin.prevout.hash, txPrev, hashBlock, true)) {
+            scriptPubKeyPrev = txPrev.vout[txin.prevout.n].scriptPubKey;
+            pivInput->SetInput(txPrev, txin.prevout.n);
+        } else {
+            // A pruned node may no longer have the previous transaction's block, but the unspent output is in the coins view
+            CCoins coins;
+            {
+                LOCK(cs_main);
+                if (!fHavePruned || !pcoinsTip->GetCoins(txin.prevout.hash, coins) || !coins.IsAvailable(txin.prevout.n))
+                    return error("CheckProofOfStake() : INFO: read txPrev failed");
+            }
+            scriptPubKeyPrev = coins.vout[txin.prevout.n].scriptPubKey;
+            pivInput->SetPrevout(txin.prevout, coins.vout[txin.prevout.n]);
+        }
 
         //verify signature and script
-        if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+        if (!VerifyScript(txin.scriptSig, scriptPubKeyPrev, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
             return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
-        CPivStake* pivInput = new CPivStake();
-        pivInput->SetInput(txPrev, txin.prevout.n);
-        stake = std::unique_ptr<CStakeInput>(pivInput);
+        stake = std::move(pivInput);
     }
 
     CBlockIndex* pindex = stake->GetIndexFrom();
     if (!pindex)
         return error("%s: Failed to find the block index", __func__);
 
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(block.nBits);
 
@@ -392,7 +564,8 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
     if (!stake->GetModifier(nStakeModifier))
         return error("%s failed to get modifier for stake input\n", __func__);
 
-    unsigned int nBlockFromTime = blockprev.nTime;
+    // The header is in the block index, so this works even when the block itself has been pruned
+    unsigned int nBlockFromTime = pindex->nTime;
     unsigned int nTxTime = block.nTime;
     if (!CheckStake(stake->GetUniqueness(), stake->GetValue(), nStakeModifier, bnTargetPerCoinDay, nBlockFromTime,
                     nTxTime, hashProofOfStake)) {
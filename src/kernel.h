@@ -6,8 +6,16 @@
 #ifndef BITCOIN_KERNEL_H
 #define BITCOIN_KERNEL_H
 
+#include "hash.h"
+#include "lrucache.h"
 #include "main.h"
 #include "stakeinput.h"
+#include "sync.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
 
 
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
@@ -20,6 +28,47 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+// Number of resolved stake modifiers kept in memory
+static const size_t STAKE_MODIFIER_CACHE_SIZE = 50000;
+
+// Stake modifiers already resolved for a block, shared by staking and block validation.
+// Resolving one walks the active chain forward from the block, so the cache is cleared whenever a block is disconnected.
+// The staker resolves modifiers without cs_main, so each Clear() starts a new generation and a Set() for a modifier
+// resolved in an earlier generation, possibly on the chain that was just disconnected, is dropped.
+class CStakeModifierCache
+{
+public:
+    struct CEntry
+    {
+        uint64_t nStakeModifier;
+        int nStakeModifierHeight;
+        int64_t nStakeModifierTime;
+    };
+
+private:
+    CCriticalSection cs_modifiercache;
+    lrucache<uint256, CEntry> cache;
+    uint64_t nGeneration;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CStakeModifierCache() : cache(STAKE_MODIFIER_CACHE_SIZE), nGeneration(0), nHits(0), nMisses(0) {}
+
+    // Take the generation before walking the chain, and pass it to Set() with the result
+    uint64_t GetGeneration();
+    bool Get(const uint256& hashBlockFrom, CEntry& entry);
+    void Set(const uint256& hashBlockFrom, const CEntry& entry, uint64_t nGenerationResolved);
+    void Clear();
+
+    size_t Size();
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+};
+
+extern CStakeModifierCache stakeModifierCache;
+
 // Compute the hash modifier for proof-of-stake
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
@@ -28,6 +77,42 @@ bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
 bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
 
+// Default for -stakethreads, 0 = one thread per core
+static const int DEFAULT_STAKE_SEARCH_THREADS = 0;
+// Below this many inputs the kernel search stays on the calling thread
+static const unsigned int STAKE_SEARCH_MIN_INPUTS_PER_THREAD = 64;
+
+// Searches a list of stake inputs for a kernel. The modifier, block time and uniqueness of each input
+// are hashed once up front, so each time slot only adds the timestamp to a copy of that hash state.
+class CStakeKernelSearch
+{
+private:
+    struct CKernelInput
+    {
+        CStakeInput* stakeInput;
+        CHash256 hasherPrefix;
+        CAmount nValueIn;
+        unsigned int nTimeBlockFrom;
+    };
+
+    uint256 bnTargetPerCoinDay;
+    std::vector<CKernelInput> vInputs;
+
+    bool SearchInput(const CKernelInput& input, unsigned int nTimeTx, unsigned int& nTimeFound, uint256& hashProofOfStake) const;
+    void SearchThread(unsigned int nTimeTx, int nHeightStart, size_t* pnNext, size_t* pnFound, boost::mutex* pmutex) const;
+
+public:
+    CStakeKernelSearch(unsigned int nBits);
+
+    // Prepare an input for the search, returns false if its block or modifier is not available
+    bool AddInput(CStakeInput* stakeInput);
+    // Find the first input at or after nStart with a kernel in the hash drift window above nTimeTx
+    bool Search(size_t nStart, unsigned int nTimeTx, size_t& nInputFound, unsigned int& nTimeFound, uint256& hashProofOfStake) const;
+
+    CStakeInput* GetInput(size_t n) const { return vInputs[n].stakeInput; }
+    size_t size() const { return vInputs.size(); }
+};
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::unique_ptr<CStakeInput>& stake);
@@ -106,11 +106,14 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 /** Verifies that a commitment c is accumulated in accumulator a
  */
 bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& valueOfCommitmentToCoin) const {
-	CBigNum sg = params->accumulatorPoKCommitmentGroup.g;
-	CBigNum sh = params->accumulatorPoKCommitmentGroup.h;
+	const IntegerGroupParams& sgroup = params->accumulatorPoKCommitmentGroup;
+	const IntegerGroupParams& qrn = params->accumulatorQRNCommitmentGroup;
 
-	CBigNum g_n = params->accumulatorQRNCommitmentGroup.g;
-	CBigNum h_n = params->accumulatorQRNCommitmentGroup.h;
+	CBigNum sg = sgroup.g;
+	CBigNum sh = sgroup.h;
+
+	CBigNum g_n = qrn.g;
+	CBigNum h_n = qrn.h;
 
 	//According to the proof, this hash should be of length k_prime bits.  It is currently greater than that, which should not be a problem, but we should check this.
 	CHashWriter hasher(0,0);
@@ -118,14 +121,15 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	// The fixed generators go through the precomputed tables; (h_n^-1)^x is evaluated as h_n^-x
+	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, sgroup.modulus) * sgroup.gPow(s_alpha, sgroup.modulus) * sgroup.hPow(s_phi, sgroup.modulus)) % sgroup.modulus;
+	CBigNum st_2_prime = (sgroup.gPow(c, sgroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(sgroup.modulus)).pow_mod(s_gamma, sgroup.modulus)) * sgroup.hPow(s_psi, sgroup.modulus)) % sgroup.modulus;
+	CBigNum st_3_prime = (sgroup.gPow(c, sgroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, sgroup.modulus) * sgroup.hPow(s_xi, sgroup.modulus)) % sgroup.modulus;
 
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * qrn.hPow(s_zeta, params->accumulatorModulus) * qrn.gPow(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
+	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * qrn.hPow(s_eta, params->accumulatorModulus) * qrn.gPow(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
+	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * qrn.hPow(CBigNum(0) - s_beta, params->accumulatorModulus)) % params->accumulatorModulus;
+	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * qrn.hPow(CBigNum(0) - s_delta, params->accumulatorModulus) * qrn.gPow(CBigNum(0) - s_beta, params->accumulatorModulus)) % params->accumulatorModulus;
 
 	bool result = false;
 
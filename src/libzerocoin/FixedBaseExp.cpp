@@ -0,0 +1,99 @@
+/**
+ * @file       FixedBaseExp.cpp
+ *
+ * @brief      Fixed-base modular exponentiation for the Zerocoin library.
+ *
+ * @copyright  Copyright 2018 The Escrow developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2018 The Escrow developers
+
+#include "FixedBaseExp.h"
+
+namespace libzerocoin {
+
+FixedBaseExp::FixedBaseExp(const CBigNum& base, const CBigNum& modulus, uint32_t nMaxExponentBits):
+	base(base), modulus(modulus), nMaxExponentBits(nMaxExponentBits), mont(NULL) {
+
+	// Montgomery arithmetic needs an odd modulus, anything else is served by pow_mod
+	if (modulus <= CBigNum(1) || !BN_is_odd(modulus.bn))
+		return;
+
+	CAutoBN_CTX pctx;
+	mont = BN_MONT_CTX_new();
+	if (!mont || !BN_MONT_CTX_set(mont, modulus.bn, pctx))
+		throw bignum_error("FixedBaseExp : BN_MONT_CTX_set failed");
+
+	if (!BN_to_montgomery(montOne.bn, CBigNum(1).bn, mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_to_montgomery failed");
+
+	CBigNum reduced = base % modulus;
+	if (reduced < CBigNum(0))
+		reduced = reduced + modulus;
+
+	uint32_t nWindows = (nMaxExponentBits + FIXED_BASE_WINDOW_BITS - 1) / FIXED_BASE_WINDOW_BITS;
+	table.resize(nWindows);
+	if (nWindows == 0)
+		return;
+
+	if (!BN_to_montgomery(table[0].bn, reduced.bn, mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_to_montgomery failed");
+
+	for (uint32_t i = 1; i < nWindows; i++) {
+		table[i] = table[i - 1];
+		for (uint32_t k = 0; k < FIXED_BASE_WINDOW_BITS; k++) {
+			if (!BN_mod_mul_montgomery(table[i].bn, table[i].bn, table[i].bn, mont, pctx))
+				throw bignum_error("FixedBaseExp : BN_mod_mul_montgomery failed");
+		}
+	}
+}
+
+FixedBaseExp::~FixedBaseExp() {
+	if (mont)
+		BN_MONT_CTX_free(mont);
+}
+
+CBigNum FixedBaseExp::pow_mod(const CBigNum& e) const {
+	if (!mont || (uint32_t)e.bitSize() > nMaxExponentBits)
+		return base.pow_mod(e, modulus);
+
+	// g^-x = (g^x)^-1, matching CBigNum::pow_mod
+	if (e < CBigNum(0))
+		return pow_mod(CBigNum(0) - e).inverse(modulus);
+
+	const uint32_t nDigitMax = (1 << FIXED_BASE_WINDOW_BITS) - 1;
+	uint32_t nWindows = (e.bitSize() + FIXED_BASE_WINDOW_BITS - 1) / FIXED_BASE_WINDOW_BITS;
+	std::vector<uint32_t> digits(nWindows);
+	for (uint32_t i = 0; i < nWindows; i++) {
+		for (uint32_t k = 0; k < FIXED_BASE_WINDOW_BITS; k++) {
+			if (BN_is_bit_set(e.bn, i * FIXED_BASE_WINDOW_BITS + k))
+				digits[i] |= (1 << k);
+		}
+	}
+
+	// Walk the digit values from the largest down: "bucket" accumulates every
+	// table entry whose digit is >= d, so multiplying it into "result" once per
+	// step raises each entry to exactly its digit.
+	CAutoBN_CTX pctx;
+	CBigNum result = montOne;
+	CBigNum bucket = montOne;
+	bool fBucketUsed = false;
+	for (uint32_t d = nDigitMax; d > 0; d--) {
+		for (uint32_t i = 0; i < nWindows; i++) {
+			if (digits[i] != d)
+				continue;
+			if (!BN_mod_mul_montgomery(bucket.bn, bucket.bn, table[i].bn, mont, pctx))
+				throw bignum_error("FixedBaseExp::pow_mod : BN_mod_mul_montgomery failed");
+			fBucketUsed = true;
+		}
+		if (fBucketUsed && !BN_mod_mul_montgomery(result.bn, result.bn, bucket.bn, mont, pctx))
+			throw bignum_error("FixedBaseExp::pow_mod : BN_mod_mul_montgomery failed");
+	}
+
+	CBigNum ret;
+	if (!BN_from_montgomery(ret.bn, result.bn, mont, pctx))
+		throw bignum_error("FixedBaseExp::pow_mod : BN_from_montgomery failed");
+	return ret;
+}
+
+} /* namespace libzerocoin */
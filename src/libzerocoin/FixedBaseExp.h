@@ -0,0 +1,67 @@
+/**
+ * @file       FixedBaseExp.h
+ *
+ * @brief      Fixed-base modular exponentiation for the Zerocoin library.
+ *
+ * @copyright  Copyright 2018 The Escrow developers
+ * @license    This project is released under the MIT license.
+ **/
+// Copyright (c) 2018 The Escrow developers
+
+#ifndef FIXEDBASEEXP_H_
+#define FIXEDBASEEXP_H_
+
+#include <memory>
+#include <vector>
+#include "bignum.h"
+
+// Width in bits of the exponent digits used by the fixed-base tables
+#define FIXED_BASE_WINDOW_BITS              5
+
+namespace libzerocoin {
+
+/**
+ * Precomputed powers of a fixed base modulo a fixed odd modulus.
+ *
+ * Stores base^(2^(w*i)) in Montgomery form for every w-bit digit of the
+ * largest supported exponent and evaluates base^e with the
+ * Brickell-Gordon-McCurley-Wilson bucket method, which needs no squarings
+ * at all: one multiplication per non-zero digit plus 2^(w+1) to combine.
+ * Results are identical to CBigNum::pow_mod, which is used for any
+ * exponent the table does not cover.
+ */
+class FixedBaseExp {
+public:
+	/**
+	 * Builds the table.
+	 *
+	 * @param base the fixed base
+	 * @param modulus an odd modulus
+	 * @param nMaxExponentBits the largest exponent size served from the table
+	 */
+	FixedBaseExp(const CBigNum& base, const CBigNum& modulus, uint32_t nMaxExponentBits);
+	~FixedBaseExp();
+
+	/** @return base^e mod modulus */
+	CBigNum pow_mod(const CBigNum& e) const;
+
+	const CBigNum& getBase() const { return base; }
+	const CBigNum& getModulus() const { return modulus; }
+	uint32_t getMaxExponentBits() const { return nMaxExponentBits; }
+
+private:
+	FixedBaseExp(const FixedBaseExp&);
+	FixedBaseExp& operator=(const FixedBaseExp&);
+
+	CBigNum base;
+	CBigNum modulus;
+	uint32_t nMaxExponentBits;
+	BN_MONT_CTX* mont;
+	CBigNum montOne;
+
+	// table[i] = base^(2^(FIXED_BASE_WINDOW_BITS*i)) * R mod modulus
+	std::vector<CBigNum> table;
+};
+
+} /* namespace libzerocoin */
+#endif /* FIXEDBASEEXP_H_ */
@@ -14,6 +14,7 @@
 
 #include "Params.h"
 #include "ParamGeneration.h"
+#include "Commitment.h"
 
 namespace libzerocoin {
 
@@ -29,6 +30,23 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 
 	this->accumulatorParams.initialized = true;
 	this->initialized = true;
+
+	precompute();
+}
+
+void ZerocoinParams::precompute() {
+	// The largest exponents any proof raises a generator to are the
+	// responses of the accumulator PoK, which scale with the accumulator
+	// modulus, plus the challenge and statistical margin. Anything larger
+	// is still handled, just without the tables.
+	uint32_t nMaxExponentBits = 2 * std::max(accumulatorParams.accumulatorModulus.bitSize(),
+	                                         serialNumberSoKCommitmentGroup.modulus.bitSize()) +
+	                            COMMITMENT_EQUALITY_CHALLENGE_SIZE + COMMITMENT_EQUALITY_SECMARGIN;
+
+	coinCommitmentGroup.precompute(coinCommitmentGroup.modulus, nMaxExponentBits);
+	serialNumberSoKCommitmentGroup.precompute(serialNumberSoKCommitmentGroup.modulus, nMaxExponentBits);
+	accumulatorParams.accumulatorPoKCommitmentGroup.precompute(accumulatorParams.accumulatorPoKCommitmentGroup.modulus, nMaxExponentBits);
+	accumulatorParams.accumulatorQRNCommitmentGroup.precompute(accumulatorParams.accumulatorModulus, nMaxExponentBits);
 }
 
 AccumulatorAndProofParams::AccumulatorAndProofParams() {
@@ -46,4 +64,21 @@ CBigNum IntegerGroupParams::randomElement() const {
 	return this->g.pow_mod(CBigNum::randBignum(this->groupOrder),this->modulus);
 }
 
+void IntegerGroupParams::precompute(const CBigNum& m, uint32_t nMaxExponentBits) {
+	this->gTable = std::make_shared<const FixedBaseExp>(this->g, m, nMaxExponentBits);
+	this->hTable = std::make_shared<const FixedBaseExp>(this->h, m, nMaxExponentBits);
+}
+
+CBigNum IntegerGroupParams::gPow(const CBigNum& e, const CBigNum& m) const {
+	if (this->gTable && this->gTable->getModulus() == m && this->gTable->getBase() == this->g)
+		return this->gTable->pow_mod(e);
+	return this->g.pow_mod(e, m);
+}
+
+CBigNum IntegerGroupParams::hPow(const CBigNum& e, const CBigNum& m) const {
+	if (this->hTable && this->hTable->getModulus() == m && this->hTable->getBase() == this->h)
+		return this->hTable->pow_mod(e);
+	return this->h.pow_mod(e, m);
+}
+
 } /* namespace libzerocoin */
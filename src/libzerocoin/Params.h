@@ -15,7 +15,9 @@
 #ifndef PARAMS_H_
 #define PARAMS_H_
 
+#include <memory>
 #include "bignum.h"
+#include "FixedBaseExp.h"
 #include "ZerocoinDefines.h"
 
 namespace libzerocoin {
@@ -33,6 +35,21 @@ public:
 	 * @return a random element in the group.
 	 */
 	CBigNum randomElement() const;
+
+	/**
+	 * Builds fixed-base exponentiation tables for g and h.
+	 * @param m the modulus the generators are raised under
+	 * @param nMaxExponentBits the largest exponent size served from the tables
+	 */
+	void precompute(const CBigNum& m, uint32_t nMaxExponentBits);
+
+	/**
+	 * Raises g (respectively h) to e mod m, through the precomputed
+	 * table when one was built for m and through pow_mod otherwise.
+	 */
+	CBigNum gPow(const CBigNum& e, const CBigNum& m) const;
+	CBigNum hPow(const CBigNum& e, const CBigNum& m) const;
+
 	bool initialized;
 
 	/**
@@ -57,6 +74,12 @@ public:
 	 */
 	CBigNum groupOrder;
 
+	/**
+	 * Fixed-base tables for g and h, not serialized.
+	 */
+	std::shared_ptr<const FixedBaseExp> gTable;
+	std::shared_ptr<const FixedBaseExp> hTable;
+
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 		    READWRITE(initialized);
@@ -175,6 +198,12 @@ public:
 	ZerocoinParams(CBigNum accumulatorModulus,
 	       uint32_t securityLevel = ZEROCOIN_DEFAULT_SECURITYLEVEL);
 
+	/**
+	 * Builds the fixed-base exponentiation tables of every group generator
+	 * used by proof verification. Called by the constructor.
+	 */
+	void precompute();
+
 	bool initialized;
 
 	AccumulatorAndProofParams accumulatorParams;
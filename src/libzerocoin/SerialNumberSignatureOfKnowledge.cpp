@@ -13,10 +13,30 @@
 // Copyright (c) 2018 The Escrow developers
 
 #include <streams.h>
+#include <atomic>
+#include <exception>
+#include <boost/thread.hpp>
 #include "SerialNumberSignatureOfKnowledge.h"
 
 namespace libzerocoin {
 
+static std::atomic<unsigned int> nVerifyThreads(1);
+static thread_local bool fVerifySerial = false;
+
+void SerialNumberSignatureOfKnowledge::SetVerifyThreads(unsigned int nThreads) {
+	if (nThreads > ZEROCOIN_MAX_VERIFY_THREADS)
+		nThreads = ZEROCOIN_MAX_VERIFY_THREADS;
+	nVerifyThreads = nThreads ? nThreads : 1;
+}
+
+unsigned int SerialNumberSignatureOfKnowledge::GetVerifyThreads() {
+	return nVerifyThreads;
+}
+
+void SerialNumberSignatureOfKnowledge::SetVerifySerialOnThisThread(bool fSerial) {
+	fVerifySerial = fSerial;
+}
+
 SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const ZerocoinParams* p): params(p) { }
 
 // Use one 256 bit seed and concatenate 4 unique 256 bit hashes to make a 1024 bit hash
@@ -112,42 +132,81 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBigNum& a_exp,const CBigNum& b_exp,
         const CBigNum& h_exp) const {
 
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
+	// a and b are the coinCommitmentGroup generators, whose modulus is the
+	// order of the serialNumberSoKCommitmentGroup, so all four bases are
+	// served from the precomputed tables.
+	CBigNum exponent = (params->coinCommitmentGroup.gPow(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
+	                   * params->coinCommitmentGroup.hPow(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
+
+	return (params->serialNumberSoKCommitmentGroup.gPow(exponent, params->serialNumberSoKCommitmentGroup.modulus) * params->serialNumberSoKCommitmentGroup.hPow(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
+}
+
+CBigNum SerialNumberSignatureOfKnowledge::tprimeCalculation(uint32_t i, const CBigNum& coinSerialNumber,
+        const CBigNum& valueOfCommitmentToCoin) const {
+	const unsigned char *hashbytes = (const unsigned char*) &this->hash;
 
-	CBigNum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
-	                   * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
+	int bit = i % 8;
+	int byte = i / 8;
+	bool challenge_bit = ((hashbytes[byte] >> bit) & 0x01);
+	if(challenge_bit) {
+		return challengeCalculation(coinSerialNumber, s_notprime[i], SeedTo1024(sprime[i].getuint256()));
+	}
 
-	return (g.pow_mod(exponent, params->serialNumberSoKCommitmentGroup.modulus) * h.pow_mod(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
+	CBigNum exp = params->coinCommitmentGroup.hPow(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
+	return ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
+	        (params->serialNumberSoKCommitmentGroup.hPow(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
+	       params->serialNumberSoKCommitmentGroup.modulus;
+}
+
+void SerialNumberSignatureOfKnowledge::tprimeRange(uint32_t nStart, uint32_t nStride, const CBigNum& coinSerialNumber,
+        const CBigNum& valueOfCommitmentToCoin, vector<CBigNum>& tprime) const {
+	// Each worker owns every nStride'th slot, so no two threads write the same element
+	for(uint32_t i = nStart; i < params->zkp_iterations; i += nStride) {
+		tprime[i] = tprimeCalculation(i, coinSerialNumber, valueOfCommitmentToCoin);
+	}
 }
 
 bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, const CBigNum& valueOfCommitmentToCoin,
         const uint256 msghash) const {
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
 	CHashWriter hasher(0,0);
 	hasher << *params << valueOfCommitmentToCoin << coinSerialNumber << msghash;
 
+	// A malformed proof must not index past the end of the responses
+	if (s_notprime.size() < params->zkp_iterations || sprime.size() < params->zkp_iterations)
+		return false;
+
 	vector<CBigNum> tprime(params->zkp_iterations);
-	unsigned char *hashbytes = (unsigned char*) &this->hash;
 
-	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
-		int bit = i % 8;
-		int byte = i / 8;
-		bool challenge_bit = ((hashbytes[byte] >> bit) & 0x01);
-		if(challenge_bit) {
-			tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], SeedTo1024(sprime[i].getuint256()));
-		} else {
-			CBigNum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-			tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
-			             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
-			            params->serialNumberSoKCommitmentGroup.modulus;
+	// The tprime values are independent of each other, only the hash
+	// below has to consume them in order.
+	uint32_t nThreads = fVerifySerial ? 1 : std::min<uint32_t>(GetVerifyThreads(), params->zkp_iterations);
+	if (nThreads <= 1) {
+		tprimeRange(0, 1, coinSerialNumber, valueOfCommitmentToCoin, tprime);
+	} else {
+		vector<std::exception_ptr> vErrors(nThreads);
+		boost::thread_group workers;
+		for(uint32_t t = 1; t < nThreads; t++) {
+			workers.create_thread([&, t]() {
+				try {
+					tprimeRange(t, nThreads, coinSerialNumber, valueOfCommitmentToCoin, tprime);
+				} catch (...) {
+					vErrors[t] = std::current_exception();
+				}
+			});
+		}
+		// The calling thread takes the first share rather than idling in join_all
+		try {
+			tprimeRange(0, nThreads, coinSerialNumber, valueOfCommitmentToCoin, tprime);
+		} catch (...) {
+			vErrors[0] = std::current_exception();
+		}
+		workers.join_all();
+		for (const std::exception_ptr& e : vErrors) {
+			if (e)
+				std::rethrow_exception(e);
 		}
 	}
+
 	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
 		hasher << tprime[i];
 	}
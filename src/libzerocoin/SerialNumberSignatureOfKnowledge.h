@@ -51,6 +51,22 @@ public:
 	 * @return
 	 */
 	bool Verify(const CBigNum& coinSerialNumber, const CBigNum& valueOfCommitmentToCoin,const uint256 msghash) const;
+
+	/** Sets the number of worker threads Verify() spreads the per-iteration
+	 * challenge computations across. 0 or 1 verifies on the calling thread.
+	 *
+	 * @param nThreads number of worker threads, capped at ZEROCOIN_MAX_VERIFY_THREADS
+	 */
+	static void SetVerifyThreads(unsigned int nThreads);
+	static unsigned int GetVerifyThreads();
+
+	/** Keeps Verify() on the calling thread, whatever SetVerifyThreads() says.
+	 * Check queue workers already verify several proofs side by side and must
+	 * not start threads of their own for each one.
+	 *
+	 * @param fSerial true to verify serially on this thread
+	 */
+	static void SetVerifySerialOnThisThread(bool fSerial);
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 	    READWRITE(s_notprime);
@@ -70,6 +86,10 @@ private:
 	vector<CBigNum> sprime;
 	inline CBigNum challengeCalculation(const CBigNum& a_exp, const CBigNum& b_exp,
 	                                   const CBigNum& h_exp) const;
+	CBigNum tprimeCalculation(uint32_t i, const CBigNum& coinSerialNumber,
+	                          const CBigNum& valueOfCommitmentToCoin) const;
+	void tprimeRange(uint32_t nStart, uint32_t nStride, const CBigNum& coinSerialNumber,
+	                 const CBigNum& valueOfCommitmentToCoin, vector<CBigNum>& tprime) const;
 };
 
 } /* namespace libzerocoin */
@@ -35,6 +35,9 @@
 // Activate multithreaded mode for proof verification
 #define ZEROCOIN_THREADING 1
 
+// Upper bound on the worker threads used to verify a serial number signature of knowledge
+#define ZEROCOIN_MAX_VERIFY_THREADS         16
+
 // Uses a fast technique for coin generation. Could be more vulnerable
 // to timing attacks. Turn off if an attacker can measure coin minting time.
 #define	ZEROCOIN_FAST_MINT 1
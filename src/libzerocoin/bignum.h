@@ -15,6 +15,10 @@
 #include "uint256.h"
 #include "version.h"
 
+namespace libzerocoin {
+class FixedBaseExp;
+}
+
 /** Errors thrown by the bignum class */
 class bignum_error : public std::runtime_error
 {
@@ -55,6 +59,7 @@ public:
 class CBigNum
 {
     BIGNUM* bn;
+    friend class libzerocoin::FixedBaseExp;
 public:
     CBigNum()
     {
@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef Escrow_LRUCACHE_H
+#define Escrow_LRUCACHE_H
+
+#include <list>
+#include <map>
+#include <utility>
+
+/** STL-like map container that keeps at most N elements, evicting the least recently used one first. */
+template <typename K, typename V>
+class lrucache
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+    typedef typename std::list<value_type>::size_type size_type;
+
+protected:
+    //! most recently used element at the front
+    std::list<value_type> items;
+    typedef typename std::list<value_type>::iterator iterator;
+    std::map<K, iterator> index;
+    size_type nMaxSize;
+
+    void limit(size_type s)
+    {
+        while (s && items.size() > s) {
+            index.erase(items.back().first);
+            items.pop_back();
+        }
+    }
+
+public:
+    lrucache(size_type nMaxSizeIn = 0) { nMaxSize = nMaxSizeIn; }
+    size_type size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    size_type count(const key_type& k) const { return index.count(k); }
+
+    /** Copy the value stored under k into v and mark it as most recently used */
+    bool get(const key_type& k, mapped_type& v)
+    {
+        typename std::map<K, iterator>::iterator it = index.find(k);
+        if (it == index.end())
+            return false;
+        items.splice(items.begin(), items, it->second);
+        v = it->second->second;
+        return true;
+    }
+
+    void insert(const key_type& k, const mapped_type& v)
+    {
+        typename std::map<K, iterator>::iterator it = index.find(k);
+        if (it != index.end()) {
+            it->second->second = v;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        items.push_front(value_type(k, v));
+        index.insert(std::make_pair(k, items.begin()));
+        limit(nMaxSize);
+    }
+
+    void erase(const key_type& k)
+    {
+        typename std::map<K, iterator>::iterator it = index.find(k);
+        if (it == index.end())
+            return;
+        items.erase(it->second);
+        index.erase(it);
+    }
+
+    void clear()
+    {
+        items.clear();
+        index.clear();
+    }
+
+    size_type max_size() const { return nMaxSize; }
+    size_type max_size(size_type s)
+    {
+        limit(s);
+        nMaxSize = s;
+        return nMaxSize;
+    }
+};
+
+#endif // Escrow_LRUCACHE_H
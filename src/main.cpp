@@ -12,12 +12,15 @@
 #include "accumulatormap.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/common.h"
 #include "init.h"
 #include "kernel.h"
+#include "lrucache.h"
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
@@ -35,14 +38,17 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 #include "zpivchain.h"
+#include "zpivspendcache.h"
 
 #include "primitives/zerocoin.h"
 #include "libzerocoin/Denominations.h"
 #include "invalid.h"
 
+#include <atomic>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
@@ -77,6 +83,11 @@ bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+bool fHeadersFirstSync = false;
+bool fCompactBlocks = DEFAULT_COMPACT_BLOCKS;
+bool fHavePruned = false;
+bool fPruneMode = false;
+uint64_t nPruneTarget = 0;
 bool fVerifyingBlocks = false;
 unsigned int nCoinCacheSize = 5000;
 bool fAlerts = DEFAULT_ALERTS;
@@ -105,6 +116,7 @@ map<uint256, int64_t> mapZerocoinspends; //txid, time received
 void EraseOrphansFor(NodeId peer);
 
 static void CheckBlockIndex();
+static void FindFilesToPrune(std::set<int>& setFilesToPrune);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -150,6 +162,11 @@ multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 CCriticalSection cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
+/** Global flag to indicate we should check to see if there are
+ *  block/undo files that should be deleted.  Set on startup
+ *  or if we allocate more file space when we're in prune mode
+ */
+bool fCheckForPruning = false;
 
 /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -178,6 +195,20 @@ map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/**
+ * Blocks that arrived during headers-first sync before their parent. Proof-of-stake validation
+ * needs the parent connected, so they wait here for it. Protected by cs_main.
+ */
+struct CBlockAwaitingParent {
+    CBlock block;
+    NodeId nodeFrom;
+    unsigned int nSize;
+};
+map<uint256, CBlockAwaitingParent> mapBlocksAwaitingParent;
+multimap<uint256, uint256> mapBlocksAwaitingParentByPrev;
+/** Serialized size of the blocks in mapBlocksAwaitingParent. */
+size_t nBlocksAwaitingParentSize = 0;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
@@ -230,10 +261,19 @@ struct CNodeState {
     bool fSyncStarted;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
+    //! How often this peer stalled block download and had its blocks reassigned.
+    int nDownloadStalls;
+    //! Until when (in microseconds) no blocks are requested from this peer after it stalled.
+    int64_t nDownloadBackoffUntil;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Compact block from this peer waiting for the transactions we asked for with getblocktxn.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+    uint256 hashPartialBlock;
+    //! Number of getheaders sent to this peer that it hasn't answered yet, only answers are accepted.
+    int nHeadersRequested;
 
     CNodeState()
     {
@@ -245,8 +285,11 @@ struct CNodeState {
         pindexLastCommonBlock = NULL;
         fSyncStarted = false;
         nStallingSince = 0;
+        nDownloadStalls = 0;
+        nDownloadBackoffUntil = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nHeadersRequested = 0;
     }
 };
 
@@ -262,6 +305,15 @@ CNodeState* State(NodeId pnode)
     return &it->second;
 }
 
+/** Ask a peer for headers, counting the request so its answer is accepted. Requires cs_main. */
+static void PushGetHeaders(CNode* pnode, const CBlockLocator& locator, const uint256& hashStop)
+{
+    CNodeState* state = State(pnode->GetId());
+    if (state)
+        state->nHeadersRequested++;
+    pnode->PushMessage("getheaders", locator, hashStop);
+}
+
 int GetHeight()
 {
     while (true) {
@@ -456,9 +508,12 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (mapBlocksAwaitingParent.count(pindex->GetBlockHash())) {
+                // Already downloaded, waiting for its parent.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -481,6 +536,91 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     }
 }
 
+// Requires cs_main.
+void EraseBlockAwaitingParent(map<uint256, CBlockAwaitingParent>::iterator it)
+{
+    std::pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapBlocksAwaitingParentByPrev.equal_range(it->second.block.hashPrevBlock);
+    for (; range.first != range.second; range.first++) {
+        if (range.first->second == it->first) {
+            mapBlocksAwaitingParentByPrev.erase(range.first);
+            break;
+        }
+    }
+    nBlocksAwaitingParentSize -= it->second.nSize;
+    mapBlocksAwaitingParent.erase(it);
+}
+
+/** Park a block we requested while its parent is neither downloaded nor connected. Requires cs_main. */
+bool QueueBlockAwaitingParent(const CBlock& block, NodeId nodeid)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+    if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA) || chainActive.Contains(mi->second))
+        return false;
+    // Only requested blocks are parked, so the download window bounds how many there can be;
+    // their total size is capped too, a window of large blocks would not fit in memory
+    uint256 hash = block.GetHash();
+    if (!mapBlocksInFlight.count(hash) || mapBlocksAwaitingParent.count(hash))
+        return false;
+
+    MarkBlockAsReceived(hash);
+    unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (mapBlocksAwaitingParent.size() >= BLOCK_DOWNLOAD_WINDOW || nBlocksAwaitingParentSize + nSize > MAX_BLOCKS_AWAITING_PARENT_SIZE) {
+        // Forget children of blocks that turned out invalid; if that frees nothing, drop this
+        // block, it is requested again once the window reaches it
+        for (map<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.begin(); it != mapBlocksAwaitingParent.end();) {
+            BlockMap::iterator miPrev = mapBlockIndex.find(it->second.block.hashPrevBlock);
+            if (miPrev != mapBlockIndex.end() && !miPrev->second->IsValid(BLOCK_VALID_TREE))
+                EraseBlockAwaitingParent(it++);
+            else
+                it++;
+        }
+        if (mapBlocksAwaitingParent.size() >= BLOCK_DOWNLOAD_WINDOW || nBlocksAwaitingParentSize + nSize > MAX_BLOCKS_AWAITING_PARENT_SIZE) {
+            LogPrint("net", "%s: dropping block %s, no room left for blocks waiting for their parent\n", __func__, hash.ToString());
+            return true;
+        }
+    }
+
+    CBlockAwaitingParent& entry = mapBlocksAwaitingParent[hash];
+    entry.block = block;
+    entry.nodeFrom = nodeid;
+    entry.nSize = nSize;
+    nBlocksAwaitingParentSize += nSize;
+    mapBlocksAwaitingParentByPrev.insert(std::make_pair(block.hashPrevBlock, hash));
+    LogPrint("net", "%s: block %s waits for parent %s peer=%d\n", __func__, hash.ToString(), block.hashPrevBlock.ToString(), nodeid);
+    return true;
+}
+
+/**
+ * Process the parked children of a newly accepted block, and in turn theirs. Called by
+ * ProcessNewBlock, so they are released however the parent arrived.
+ */
+void ProcessBlocksAwaitingParent(const uint256& hashParent)
+{
+    deque<uint256> queue;
+    queue.push_back(hashParent);
+    while (!queue.empty()) {
+        vector<CBlockAwaitingParent> vChildren;
+        {
+            LOCK(cs_main);
+            std::pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapBlocksAwaitingParentByPrev.equal_range(queue.front());
+            while (range.first != range.second) {
+                map<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.find((range.first++)->second);
+                vChildren.push_back(it->second);
+                mapBlockSource[it->first] = it->second.nodeFrom;
+                EraseBlockAwaitingParent(it);
+            }
+        }
+        queue.pop_front();
+
+        BOOST_FOREACH (CBlockAwaitingParent& child, vChildren) {
+            CValidationState state;
+            // The loop walks the descendants itself rather than recursing through ProcessNewBlock
+            if (ProcessNewBlock(state, NULL, &child.block, NULL, false, false))
+                queue.push_back(child.block.GetHash());
+        }
+    }
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
@@ -981,7 +1121,7 @@ bool ContextualCheckZerocoinSpend(const CTransaction& tx, const CoinSpend& spend
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state)
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1036,12 +1176,18 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
                 return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
             }
 
-            Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-                                    newSpend.getDenomination(), bnAccumulatorValue);
-
-            //Check that the coin has been accumulated
-            if(!newSpend.Verify(accumulator))
+            libzerocoin::ZerocoinParams* paramsAccumulator = Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start());
+            if (pvChecks) {
+                //Check that the coin has been accumulated, deferred to the caller's check queue
+                pvChecks->push_back(CZerocoinSpendCheck());
+                CZerocoinSpendCheck check(newSpend, paramsAccumulator, bnAccumulatorValue, tx.GetHash());
+                check.swap(pvChecks->back());
+            } else {
+                //Check that the coin has been accumulated
+                CZerocoinSpendCheck check(newSpend, paramsAccumulator, bnAccumulatorValue, tx.GetHash());
+                if (!check())
                     return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+            }
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1061,7 +1207,7 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks, bool fCheckZerocoinMints)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1095,7 +1241,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
         if (!MoneyRange(nValueOut))
             return state.DoS(100, error("CheckTransaction() : txout total out of range"),
                 REJECT_INVALID, "bad-txns-txouttotal-toolarge");
-        if (fZerocoinActive && txout.IsZerocoinMint()) {
+        if (fZerocoinActive && fCheckZerocoinMints && txout.IsZerocoinMint()) {
             if(!CheckZerocoinMint(tx.GetHash(), txout, state, true))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin mint"));
         }
@@ -1117,7 +1263,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
             bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1211,7 +1357,21 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees, fOverrideMempoolLimit);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1221,9 +1381,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
         return state.DoS(10, error("AcceptToMemoryPool : Zerocoin transactions are temporarily disabled for maintenance"), REJECT_INVALID, "bad-tx");
 
-    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), true, state))
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), true, state, &vZerocoinChecks))
         return state.DoS(100, error("AcceptToMemoryPool: : CheckTransaction failed"), REJECT_INVALID, "bad-tx");
 
+    if (!RunZerocoinSpendChecks(vZerocoinChecks))
+        return state.DoS(100, error("AcceptToMemoryPool: : zerocoin spend did not verify"), REJECT_INVALID, "bad-tx");
+
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
         return state.DoS(100, error("AcceptToMemoryPool: : coinbase as individual tx"),
@@ -1374,9 +1538,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1390,6 +1554,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // While the pool is full it only takes transactions paying more than what was last evicted
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee && !tx.IsZerocoinSpend())
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.IsZerocoinMint()) {
                 if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1427,6 +1598,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool : %s %s", hash.ToString(), errString),
+                REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1447,7 +1630,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -1466,9 +1656,13 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
         *pfMissingInputs = false;
 
 
-    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), true, state))
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), true, state, &vZerocoinChecks))
         return error("AcceptableInputs: : CheckTransaction failed");
 
+    if (!RunZerocoinSpendChecks(vZerocoinChecks))
+        return state.DoS(100, error("AcceptableInputs: : zerocoin spend did not verify"), REJECT_INVALID, "bad-tx");
+
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
         return state.DoS(100, error("AcceptableInputs: : coinbase as individual tx"),
@@ -1786,6 +1980,33 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos)
+{
+    // The block is preceded on disk by the network magic and its size, written by WriteBlockToDisk
+    if (pos.nPos < 8)
+        return error("%s : invalid block position %u in file %d", __func__, pos.nPos, pos.nFile);
+
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 8), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        MessageStartChars pchMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0 || nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("%s : no block header in file %d at %u", __func__, pos.nFile, pos.nPos);
+
+        // Disk and network serialization of a block are identical, so the bytes can be relayed as they are
+        ssBlock.resize(nSize);
+        filein.read(&ssBlock[0], nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2171,6 +2392,30 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    if (!spend || !params)
+        return false;
+
+    try {
+        // A spend already verified against this accumulator (usually when it entered the mempool) is valid again
+        uint256 hashSpend = CZerocoinSpendCache::GetSpendHash(*spend);
+        if (zerocoinSpendCache.Get(hashSpend, spend->getAccumulatorChecksum()))
+            return true;
+
+        Accumulator accumulator(params, spend->getDenomination(), bnAccumulatorValue);
+        if (!spend->Verify(accumulator))
+            return ::error("CZerocoinSpendCheck(): zerocoin spend with serial %s in tx %s did not verify",
+                           spend->getCoinSerialNumber().GetHex().substr(0, 10), txid.GetHex());
+
+        zerocoinSpendCache.Set(hashSpend, spend->getAccumulatorChecksum());
+    } catch (const std::exception& e) {
+        return ::error("CZerocoinSpendCheck(): zerocoin spend in tx %s failed to verify: %s", txid.GetHex(), e.what());
+    }
+
+    return true;
+}
+
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
 
@@ -2474,6 +2719,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if(!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        //remove this block's mints from the mint index
+        if (!pindex->vMintDenominationsInBlock.empty() && !EraseBlockPubcoinIndex(pindex))
+            return error("DisconnectBlock(): failed to erase block mint index");
     }
 
     if (pfClean) {
@@ -2517,6 +2766,149 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+void PruneOneBlockFile(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first;
+                range.first++;
+                if (itUnlinked->second == pindex)
+                    mapBlocksUnlinked.erase(itUnlinked);
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+{
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH (const CBlockFileInfo& file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+/** Mints in a block file must be in the pubcoin index before it goes, the accumulator and witness code read them from there */
+static bool IndexBlockFilePubcoins(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile != fileNumber || !(pindex->nStatus & BLOCK_HAVE_DATA) || !chainActive.Contains(pindex))
+            continue;
+        if (!IndexBlockPubcoinsIfMissing(pindex))
+            return false;
+    }
+    return true;
+}
+
+/* Calculate the block/rev files that should be deleted to remain under target */
+static void FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0)
+        return;
+
+    // Blocks that a reorg could still disconnect, and their undo data, are never pruned
+    int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - Params().MaxReorganizationDepth();
+    if (nLastBlockWeCanPrune <= 0)
+        return;
+
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files,
+    // so leave a buffer under our target to account for another allocation before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBytesToPrune;
+    int count = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0)
+                continue;
+
+            if (nCurrentUsage + nBuffer < nPruneTarget) // are we below our target?
+                break;
+
+            // don't prune files that could have a block within MaxReorganizationDepth of the main chain's tip but keep scanning
+            if ((int)vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            if (!IndexBlockFilePubcoins(fileNumber)) {
+                LogPrintf("Prune: failed to index the zerocoin mints of blk%05u.dat, keeping it\n", fileNumber);
+                continue;
+            }
+
+            PruneOneBlockFile(fileNumber);
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024,
+        ((int64_t)nPruneTarget - (int64_t)nCurrentUsage) / 1024 / 1024,
+        nLastBlockWeCanPrune, count);
+}
+
+// Each proof takes tens of milliseconds, so hand them out one at a time
+static CCheckQueue<CZerocoinSpendCheck> zerocoinspendcheckqueue(1);
+// CheckBlock runs outside cs_main, so callers take turns on the queue
+static CCriticalSection cs_zerocoinspendcheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("escrow-zcspendch");
+    // The queue already spreads the proofs over its workers
+    libzerocoin::SerialNumberSignatureOfKnowledge::SetVerifySerialOnThisThread(true);
+    zerocoinspendcheckqueue.Thread();
+}
+
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks)
+{
+    if (vChecks.empty())
+        return true;
+
+    // Without worker threads the master thread works through the queue on its own
+    LOCK(cs_zerocoinspendcheckqueue);
+    CCheckQueueControl<CZerocoinSpendCheck> control(&zerocoinspendcheckqueue);
+    control.Add(vChecks);
+    // Next to the workers the master verifies serially too, alone it may split each proof
+    libzerocoin::SerialNumberSignatureOfKnowledge::SetVerifySerialOnThisThread(nScriptCheckThreads > 0);
+    bool fOk = control.Wait();
+    libzerocoin::SerialNumberSignatureOfKnowledge::SetVerifySerialOnThisThread(false);
+    return fOk;
+}
+
 void RecalculateZESCOMinted()
 {
     CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
@@ -2536,6 +2928,7 @@ void RecalculateZESCOMinted()
         pindex->vMintDenominationsInBlock.clear();
         for (auto mint : listMints)
             pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+        pindex->SetZerocoinMintCount();
 
         if (pindex->nHeight < nHeightEnd)
             pindex = chainActive.Next(pindex);
@@ -2670,6 +3063,18 @@ bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError
 
             // find checkpoints by iterating through the blockchain beginning with the first zerocoin block
             if (pindex->nAccumulatorCheckpoint != pindex->pprev->nAccumulatorCheckpoint) {
+                // when many checkpoints are missing, recalculating everything from here on in parallel beats calculating each one alone
+                if (listMissingCheckpoints.size() >= ACCUMULATOR_REINDEX_PARALLEL_MIN && pindex->nHeight > GetParallelAccumulatorStartHeight() &&
+                    find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
+                    if (!RecalculateAccumulatorCheckpoints(pindex->nHeight, listMissingCheckpoints)) {
+                        if (ShutdownRequested())
+                            break;
+                        strError = _("Failed to calculate accumulator checkpoint");
+                        return error("%s: %s", __func__, strError);
+                    }
+                    break;
+                }
+
                 if (find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
                     uint256 nCheckpointCalculated = 0;
                     AccumulatorMap mapAccumulators(Params().Zerocoin_Params(false));
@@ -2756,6 +3161,8 @@ bool UpdateZESCOSupply(const CBlock& block, CBlockIndex* pindex)
         }
     }
 
+    pindex->SetZerocoinMintCount();
+
     for (auto& denom : zerocoinDenomList)
         LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
 
@@ -3055,6 +3462,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Flush spend/mint info to disk
     if (!zerocoinDB->WriteCoinSpendBatch(vSpends)) return state.Abort(("Failed to record coin serials to database"));
     if (!zerocoinDB->WriteCoinMintBatch(vMints)) return state.Abort(("Failed to record new mints to database"));
+    if (!vMints.empty() && !IndexBlockPubcoins(block, pindex)) return state.Abort(("Failed to record block mint index to database"));
 
     //Record accumulator checksums
     DatabaseChecksums(mapAccumulators);
@@ -3094,6 +3502,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 }
 
 enum FlushStateMode {
+    FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
     FLUSH_STATE_ALWAYS
@@ -3106,12 +3515,26 @@ enum FlushStateMode {
  */
 bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
+        if (fPruneMode && fCheckForPruning && !fReindex) {
+            FindFilesToPrune(setFilesToPrune);
+            fCheckForPruning = false;
+            if (!setFilesToPrune.empty()) {
+                fFlushForPrune = true;
+                if (!fHavePruned) {
+                    pblocktree->WriteFlag("prunedblockfiles", true);
+                    fHavePruned = true;
+                }
+            }
+        }
         if ((mode == FLUSH_STATE_ALWAYS) ||
             ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000) ||
+            fFlushForPrune) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
@@ -3143,6 +3566,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
+            // Now that the index no longer refers to them, remove any pruned files
+            if (fFlushForPrune)
+                UnlinkPrunedFiles(setFilesToPrune);
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -3161,6 +3587,13 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush()
+{
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_NONE);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
@@ -3225,17 +3658,28 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, false, true))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // Their spenders may still be in the pool, link them up before anything walks the package links
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    // Resurrected transactions bypass the size limit so that none is evicted
+    // before its descendants come back, trim once they are all in.
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    // Stake modifiers resolved through the disconnected block may change on the new chain. Cleared only
+    // once chainActive no longer has the block, so nothing resolved after this can still walk through it.
+    stakeModifierCache.Clear();
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -3848,6 +4292,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE* file = OpenBlockFile(pos);
                 if (file) {
+                    if (fPruneMode)
+                        fCheckForPruning = true;
                     LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
                     AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
                     fclose(file);
@@ -3878,6 +4324,8 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE* file = OpenUndoFile(pos);
             if (file) {
+                if (fPruneMode)
+                    fCheckForPruning = true;
                 LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
                 AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
                 fclose(file);
@@ -3910,7 +4358,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig, bool fCheckZerocoinMints)
 {
     // These are checks that are independent of context.
 
@@ -4028,8 +4476,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // Check transactions
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
     vector<CBigNum> vBlockSerials;
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state, &vZerocoinChecks, fCheckZerocoinMints))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zESCO spends in this block
@@ -4046,6 +4495,11 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    // Verify the zerocoin spend proofs of all transactions concurrently
+    if (!RunZerocoinSpendChecks(vZerocoinChecks))
+        return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+            REJECT_INVALID, "bad-zerocoinspend");
+
 
     unsigned int nSigOps = 0;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -4059,6 +4513,33 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
+bool PreCheckBlock(const CBlock& block, CValidationState& state)
+{
+    // Only checks that read nothing but the block itself belong here, this runs without cs_main
+    bool mutated;
+    uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+    if (block.hashMerkleRoot != hashMerkleRoot2)
+        return state.DoS(100, error("PreCheckBlock() : hashMerkleRoot mismatch"),
+            REJECT_INVALID, "bad-txnmrklroot", true);
+    if (mutated)
+        return state.DoS(100, error("PreCheckBlock() : duplicate transaction"),
+            REJECT_INVALID, "bad-txns-duplicate", true);
+
+    if (!CheckBlockSignature(block))
+        return state.DoS(100, error("PreCheckBlock() : bad proof-of-stake block signature"));
+
+    if (block.GetBlockTime() > Params().Zerocoin_StartTime()) {
+        for (const CTransaction& tx : block.vtx) {
+            for (const CTxOut& txout : tx.vout) {
+                if (txout.IsZerocoinMint() && !CheckZerocoinMint(tx.GetHash(), txout, state, true))
+                    return state.DoS(100, error("PreCheckBlock() : invalid zerocoin mint"));
+            }
+        }
+    }
+
+    return true;
+}
+
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
 {
     if (pindexPrev == NULL)
@@ -4353,6 +4834,9 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return state.Abort(std::string("System error: ") + e.what());
     }
 
+    if (fCheckForPruning)
+        FlushStateToDisk(state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
+
     return true;
 }
 
@@ -4417,11 +4901,11 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp, bool fPreChecked, bool fReleaseChildren)
 {
-    // Preliminary checks
+    // Preliminary checks, skipping the parts PreCheckBlock already covered
     int64_t nStartTime = GetTimeMillis();
-    bool checked = CheckBlock(*pblock, state);
+    bool checked = CheckBlock(*pblock, state, true, !fPreChecked, true, !fPreChecked);
 
     int nMints = 0;
     int nSpends = 0;
@@ -4440,7 +4924,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     if (nMints || nSpends)
         LogPrintf("%s : block contains %d zESCO mints and %d zESCO spends\n", __func__, nMints, nSpends);
 
-    if (!CheckBlockSignature(*pblock))
+    if (!fPreChecked && !CheckBlockSignature(*pblock))
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     if (pblock->GetHash() != Params().HashGenesisBlock() && pfrom != NULL) {
@@ -4495,6 +4979,9 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     LogPrintf("%s : ACCEPTED Block %ld in %ld milliseconds with size=%d\n", __func__, GetHeight(), GetTimeMillis() - nStartTime,
               pblock->GetSerializeSize(SER_DISK, CLIENT_VERSION));
 
+    if (fReleaseChildren)
+        ProcessBlocksAwaitingParent(pblock->GetHash());
+
     return true;
 }
 
@@ -4626,7 +5113,9 @@ bool static LoadBlockIndexDB(string& strError)
     BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -4665,6 +5154,11 @@ bool static LoadBlockIndexDB(string& strError)
         }
     }
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     set<int> setBlkDataFiles;
@@ -4747,6 +5241,11 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height() - nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -4858,53 +5357,263 @@ bool InitBlockIndex()
 }
 
 
+namespace {
+
+/** A block travelling through the import pipeline */
+struct CImportBlock {
+    uint64_t nRewind;   //!< where to resume scanning if the block turns out to be garbage
+    uint64_t nPos;      //!< position of the serialized block in the file
+    unsigned int nSize; //!< size from the block file header
+    uint64_t nEnd;      //!< position right after the deserialized block
+    CDataStream ssBlock;
+    CBlock block;
+    uint256 hash;
+    bool fDeserialized;
+    bool fPreChecked;
+    bool fDone;
+    std::string strError;
+
+    CImportBlock(uint64_t nRewindIn, uint64_t nPosIn, unsigned int nSizeIn) : nRewind(nRewindIn), nPos(nPosIn), nSize(nSizeIn), nEnd(0),
+                                                                               ssBlock(SER_DISK, CLIENT_VERSION), fDeserialized(false),
+                                                                               fPreChecked(false), fDone(false) {}
+};
+
+/**
+ * Block import in three stages: a reader thread scans the file for blocks and
+ * queues their raw bytes, a pool of threads deserializes them and runs
+ * PreCheckBlock, and the caller takes them back in file order with Next() to
+ * hand them to ProcessNewBlock.
+ */
+class CBlockImportPipeline
+{
+private:
+    FILE* file;
+    std::vector<char> vReadBuffer;
+    int nCheckThreads;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::shared_ptr<CImportBlock> > queue;
+    size_t nNextToCheck; //!< index into queue of the first block no check thread has taken yet
+    uint64_t nQueuedBytes;
+    bool fReadDone;
+    bool fStop;
+    std::unique_ptr<boost::thread_group> threadGroup;
+
+    // Throughput of the read and check stages, times in microseconds
+    uint64_t nBlocksRead;
+    uint64_t nBytesRead;
+    int64_t nReadTime;
+    std::atomic<uint64_t> nBlocksChecked;
+    std::atomic<int64_t> nCheckTime;
+
+    void ReadThread(uint64_t nStartPos)
+    {
+        RenameThread("escrow-loadread");
+        const MessageStartChars& pchMessageStart = Params().MessageStart();
+        uint64_t nRewind = nStartPos;
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nQueuedBytes >= MAX_IMPORT_QUEUE_BYTES)
+                    cond.wait(lock);
+                if (fStop)
+                    break;
+            }
+
+            int64_t nTimeStart = GetTimeMicros();
+            if ((uint64_t)ftell(file) != nRewind && fseek(file, nRewind, SEEK_SET) != 0)
+                break;
+            nRewind++; // start one byte further next time, in case of failure
+
+            // locate a header
+            int c;
+            while ((c = fgetc(file)) != EOF && c != pchMessageStart[0]) {
+            }
+            if (c == EOF)
+                break;
+            nRewind = ftell(file);
+            unsigned char buf[MESSAGE_START_SIZE + 4];
+            buf[0] = c;
+            if (fread(buf + 1, 1, sizeof(buf) - 1, file) != sizeof(buf) - 1)
+                break;
+            if (memcmp(buf, pchMessageStart, MESSAGE_START_SIZE))
+                continue;
+            // read size
+            unsigned int nSize = ReadLE32(buf + MESSAGE_START_SIZE);
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                continue;
+
+            std::shared_ptr<CImportBlock> pimport = std::make_shared<CImportBlock>(nRewind, ftell(file), nSize);
+            pimport->ssBlock.resize(nSize);
+            if (fread(&pimport->ssBlock[0], 1, nSize, file) != nSize)
+                break;
+            nRewind = pimport->nPos + nSize;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nReadTime += GetTimeMicros() - nTimeStart;
+            nBlocksRead++;
+            nBytesRead += MESSAGE_START_SIZE + 4 + nSize;
+            nQueuedBytes += nSize;
+            queue.push_back(pimport);
+            cond.notify_all();
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReadDone = true;
+        cond.notify_all();
+    }
+
+    void CheckThread()
+    {
+        RenameThread("escrow-loadcheck");
+        while (true) {
+            std::shared_ptr<CImportBlock> pimport;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && !fReadDone && nNextToCheck == queue.size())
+                    cond.wait(lock);
+                if (fStop || nNextToCheck == queue.size())
+                    break;
+                pimport = queue[nNextToCheck++];
+            }
+
+            int64_t nTimeStart = GetTimeMicros();
+            try {
+                pimport->ssBlock >> pimport->block;
+                pimport->nEnd = pimport->nPos + pimport->nSize - pimport->ssBlock.size();
+                pimport->hash = pimport->block.GetHash();
+                pimport->fDeserialized = true;
+                CValidationState state;
+                pimport->fPreChecked = PreCheckBlock(pimport->block, state);
+            } catch (const std::exception& e) {
+                pimport->strError = e.what();
+            }
+            pimport->ssBlock.clear();
+            nCheckTime += GetTimeMicros() - nTimeStart;
+            nBlocksChecked++;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pimport->fDone = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    /** Takes over fileIn and calls fclose() on it when destroyed */
+    CBlockImportPipeline(FILE* fileIn, int nCheckThreadsIn) : file(fileIn), vReadBuffer(IMPORT_READ_BUFFER_SIZE), nCheckThreads(nCheckThreadsIn),
+                                                              nNextToCheck(0), nQueuedBytes(0), fReadDone(false), fStop(false),
+                                                              nBlocksRead(0), nBytesRead(0), nReadTime(0), nBlocksChecked(0), nCheckTime(0)
+    {
+        setvbuf(file, &vReadBuffer[0], _IOFBF, vReadBuffer.size());
+    }
+
+    ~CBlockImportPipeline()
+    {
+        Stop();
+        fclose(file);
+    }
+
+    void Start(uint64_t nStartPos)
+    {
+        threadGroup.reset(new boost::thread_group());
+        threadGroup->create_thread(boost::bind(&CBlockImportPipeline::ReadThread, this, nStartPos));
+        for (int i = 0; i < nCheckThreads; i++)
+            threadGroup->create_thread(boost::bind(&CBlockImportPipeline::CheckThread, this));
+    }
+
+    void Stop()
+    {
+        if (!threadGroup)
+            return;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup->join_all();
+        threadGroup.reset();
+
+        queue.clear();
+        nNextToCheck = 0;
+        nQueuedBytes = 0;
+        fReadDone = false;
+        fStop = false;
+    }
+
+    /** Drop everything read ahead and continue scanning the file at nPos */
+    void Restart(uint64_t nPos)
+    {
+        Stop();
+        Start(nPos);
+    }
+
+    /** Wait for the next block in file order to finish its checks, NULL at the end of the file */
+    std::shared_ptr<CImportBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && (queue.empty() ? !fReadDone : !queue.front()->fDone))
+            cond.wait(lock);
+        if (fStop || queue.empty())
+            return std::shared_ptr<CImportBlock>();
+
+        std::shared_ptr<CImportBlock> pimport = queue.front();
+        queue.pop_front();
+        nNextToCheck--;
+        nQueuedBytes -= pimport->nSize;
+        cond.notify_all();
+        return pimport;
+    }
+
+    void LogThroughput(int nConnected, int64_t nConnectTime)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        LogPrintf("Block import: read %u blocks (%.1f MiB) in %.2fs (%.1f MiB/s), checked %u blocks on %d threads in %.2fs of thread time (%.1f blocks/s per thread), connected %d blocks in %.2fs (%.1f blocks/s)\n",
+            nBlocksRead, nBytesRead / 1048576.0, nReadTime * 0.000001, nReadTime ? nBytesRead / 1.048576 / nReadTime : 0.0,
+            (uint64_t)nBlocksChecked, nCheckThreads, nCheckTime * 0.000001, nCheckTime ? nBlocksChecked * 1000000.0 / nCheckTime : 0.0,
+            nConnected, nConnectTime * 0.000001, nConnectTime ? nConnected * 1000000.0 / nConnectTime : 0.0);
+    }
+};
+
+} // anon namespace
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+    // -importthreads=0 means autodetect
+    int nThreads = GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+
     int nLoaded = 0;
+    int64_t nConnectTime = 0;
+    // This takes over fileIn and calls fclose() on it in the CBlockImportPipeline destructor
+    CBlockImportPipeline pipeline(fileIn, std::max(nThreads, 1));
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        pipeline.Start(ftell(fileIn));
+        while (std::shared_ptr<CImportBlock> pimport = pipeline.Next()) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (!pimport->fDeserialized) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, pimport->strError);
+                pipeline.Restart(pimport->nRewind);
+                continue;
             }
+            // the size in the header overstated the block, rescan the remainder
+            if (pimport->nEnd != pimport->nPos + pimport->nSize)
+                pipeline.Restart(pimport->nEnd);
+
+            int64_t nTimeStart = GetTimeMicros();
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
+                CBlock& block = pimport->block;
+                const uint256& hash = pimport->hash;
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                    dbp->nPos = pimport->nPos;
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
                 if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                         block.hashPrevBlock.ToString());
@@ -4916,7 +5625,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
+                    if (ProcessNewBlock(state, NULL, &block, dbp, pimport->fPreChecked))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -4949,15 +5658,136 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
             } catch (std::exception& e) {
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+            nConnectTime += GetTimeMicros() - nTimeStart;
         }
     } catch (std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+    pipeline.LogThroughput(nLoaded, nConnectTime);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION)
+            return false;
+        uint64_t num;
+        file >> num;
+        // Entries come parents first and are read one at a time, the file is never held in memory
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            double dPriorityDelta;
+            CAmount nFeeDelta;
+            file >> tx;
+            file >> nTime;
+            file >> dPriorityDelta;
+            file >> nFeeDelta;
+
+            // Deltas go in first so that they count when the transaction is accepted
+            if (dPriorityDelta != 0 || nFeeDelta != 0)
+                mempool.PrioritiseTransaction(tx.GetHash(), tx.GetHash().ToString(), dPriorityDelta, nFeeDelta);
+
+            CValidationState state;
+            if (nTime + nExpiryTimeout > nNow) {
+                LOCK(cs_main);
+                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+                if (state.IsValid())
+                    ++count;
+                else
+                    ++failed;
+            } else {
+                ++skipped;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+
+        // Prioritisations of transactions that were not in the pool when it was dumped
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired in %dms\n", count, failed, skipped, GetTimeMillis() - nStart);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t start = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<CTxMemPoolEntry> vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        mempool.queryEntries(vEntries);
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr)
+            return;
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vEntries.size();
+        BOOST_FOREACH (const CTxMemPoolEntry& entry, vEntries) {
+            const uint256& hash = entry.GetTx().GetHash();
+            std::pair<double, CAmount> deltas(0, 0);
+            std::map<uint256, std::pair<double, CAmount> >::iterator it = mapDeltas.find(hash);
+            if (it != mapDeltas.end()) {
+                deltas = it->second;
+                mapDeltas.erase(it);
+            }
+            file << entry.GetTx();
+            file << entry.GetTime();
+            file << deltas.first;
+            file << deltas.second;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (mid - start) * 0.000001, (last - mid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
 void static CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
@@ -4994,6 +5824,7 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL;         // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL;         // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL;  // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL;    // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL;   // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
@@ -5001,6 +5832,7 @@ void static CheckBlockIndex()
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -5011,12 +5843,21 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis());                       // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0); // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0));                                             // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0));                                      // nChainTx == 0 is used to signal that all parent block's transaction data is available.
         assert(pindex->nHeight == nHeight);                                                                          // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork);                            // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight)));                                // The pskip pointer must point back for all but the first 2 blocks.
@@ -5028,11 +5869,20 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and
+                // is valid and we have all data for its parents, it must be in
+                // setBlockIndexCandidates.  chainActive.Tip() must also be there
+                // even if some data has been pruned.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
+                // If some parent is missing, then it could be that this block was in
+                // setBlockIndexCandidates but had to be removed because of the missing data.
+                // In this case it must be in mapBlocksUnlinked -- see test below.
             }
-        } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
+        } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
         }
         // Check whether this block is in mapBlocksUnlinked.
@@ -5046,12 +5896,24 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked);          // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+            assert(fHavePruned); // We must have pruned.
+            // This block may have entered mapBlocksUnlinked if:
+            //  - it has a descendant that at some point had more work than the tip, and
+            //  - we tried switching to that descendant but were missing data for some intermediate block between chainActive and the tip.
+            // So if this block is itself better than chainActive.Tip() and it wasn't in setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -5071,6 +5933,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -5223,6 +6086,54 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/** Serialized blocks recently sent to peers, so peers syncing the same range share one disk read */
+static CCriticalSection cs_rawblockcache;
+static lrucache<uint256, std::shared_ptr<const CDataStream> > cacheRawBlocks(MAX_RAW_BLOCK_CACHE_SIZE);
+
+static bool GetRawBlock(const uint256& hashBlock, const CDiskBlockPos& pos, std::shared_ptr<const CDataStream>& pblockRaw)
+{
+    {
+        LOCK(cs_rawblockcache);
+        if (cacheRawBlocks.get(hashBlock, pblockRaw))
+            return true;
+    }
+
+    std::shared_ptr<CDataStream> pblockRead = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    if (!ReadRawBlockFromDisk(*pblockRead, pos))
+        return false;
+    pblockRaw = pblockRead;
+
+    LOCK(cs_rawblockcache);
+    cacheRawBlocks.insert(hashBlock, pblockRaw);
+    return true;
+}
+
+/** The compact encoding of the most recently requested block, shared by all peers asking for it */
+static CCriticalSection cs_mostRecentCompactBlock;
+static uint256 hashMostRecentCompactBlock;
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> pMostRecentCompactBlock;
+
+static bool GetCompactBlock(const uint256& hashBlock, const CDiskBlockPos& pos, std::shared_ptr<const CBlockHeaderAndShortTxIDs>& pcmpctblock)
+{
+    {
+        LOCK(cs_mostRecentCompactBlock);
+        if (pMostRecentCompactBlock && hashMostRecentCompactBlock == hashBlock) {
+            pcmpctblock = pMostRecentCompactBlock;
+            return true;
+        }
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pos))
+        return false;
+    pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+
+    LOCK(cs_mostRecentCompactBlock);
+    hashMostRecentCompactBlock = hashBlock;
+    pMostRecentCompactBlock = pcmpctblock;
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -5241,7 +6152,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -5260,14 +6171,39 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    // Old blocks are not worth encoding, the peer won't have their transactions anyway
+                    bool fCompact = inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - mi->second->nHeight <= MAX_CMPCTBLOCK_DEPTH;
+                    if (fCompact) {
+                        CDiskBlockPos pos = mi->second->GetBlockPos();
+                        std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                        LEAVE_CRITICAL_SECTION(cs_main);
+                        bool fRead = GetCompactBlock(inv.hash, pos, pcmpctblock);
+                        ENTER_CRITICAL_SECTION(cs_main);
+                        if (fRead)
+                            pfrom->PushMessage("cmpctblock", *pcmpctblock);
+                        else if (mi->second->nStatus & BLOCK_HAVE_DATA)
+                            assert(!"cannot load block from disk");
+                        else // pruned while it was being read
+                            vNotFound.push_back(inv);
+                    } else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                        // Send the block bytes as stored on disk, reading them without holding cs_main
+                        CDiskBlockPos pos = mi->second->GetBlockPos();
+                        std::shared_ptr<const CDataStream> pblockRaw;
+                        LEAVE_CRITICAL_SECTION(cs_main);
+                        bool fRead = GetRawBlock(inv.hash, pos, pblockRaw);
+                        ENTER_CRITICAL_SECTION(cs_main);
+                        if (fRead)
+                            pfrom->PushMessage("block", *pblockRaw);
+                        else if (mi->second->nStatus & BLOCK_HAVE_DATA)
+                            assert(!"cannot load block from disk");
+                        else // pruned while it was being read
+                            vNotFound.push_back(inv);
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5280,7 +6216,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(CNode::InventoryKnownKey(CInv(MSG_TX, pair.second))))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -5436,7 +6372,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5455,6 +6391,66 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Process a block received from a peer, either in full or rebuilt from a compact block */
+static void ProcessBlockMessage(CNode* pfrom, CBlock& block)
+{
+    uint256 hashBlock = block.GetHash();
+    CInv inv(MSG_BLOCK, hashBlock);
+    LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
+
+    //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
+    if (!mapBlockIndex.count(block.hashPrevBlock)) {
+        if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+            //we already asked for this block, so lets work backwards and ask for the previous block
+            pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
+            pfrom->vBlockRequested.push_back(block.hashPrevBlock);
+        } else {
+            //ask to sync to this block
+            pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
+            pfrom->vBlockRequested.push_back(hashBlock);
+        }
+    } else {
+        pfrom->AddInventoryKnown(inv);
+
+        CValidationState state;
+        bool fHaveData = false;
+        bool fAwaitingParent = false;
+        {
+            LOCK(cs_main);
+            // With headers-first sync the header of a block we still need is already known
+            BlockMap::iterator miSelf = mapBlockIndex.find(hashBlock);
+            fHaveData = miSelf != mapBlockIndex.end() && (miSelf->second->nStatus & BLOCK_HAVE_DATA);
+            if (!fHaveData)
+                fAwaitingParent = QueueBlockAwaitingParent(block, pfrom->GetId());
+        }
+        if (!fHaveData) {
+            if (!fAwaitingParent)
+                ProcessNewBlock(state, pfrom, &block);
+            int nDoS;
+            if(state.IsInvalid(nDoS)) {
+                pfrom->PushMessage("reject", string("block"), state.GetRejectCode(),
+                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+                if(nDoS > 0) {
+                    TRY_LOCK(cs_main, lockMain);
+                    if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
+                }
+            }
+            //disconnect this node if its old protocol version
+            pfrom->DisconnectOldProtocol(ActiveProtocol(), "block");
+        } else {
+            LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+        }
+    }
+}
+
+/** The getdata entry for a newly announced block, a compact block if the peer can send one */
+static CInv GetBlockRequest(CNode* pfrom, const uint256& hash)
+{
+    if (fCompactBlocks && pfrom->nVersion >= COMPACT_BLOCKS_VERSION && !IsInitialBlockDownload())
+        return CInv(MSG_CMPCT_BLOCK, hash);
+    return CInv(MSG_BLOCK, hash);
+}
+
 bool fRequestedSporksIDB = false;
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
@@ -5696,9 +6692,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (fHeadersFirstSync && pfrom->nVersion >= HEADERS_FIRST_VERSION) {
+                        // Fetch the headers leading up to the announced block; SendMessages downloads the blocks.
+                        PushGetHeaders(pfrom, chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                        // Near the tip, ask for the block right away as well rather than waiting for its header
+                        if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20) {
+                            vToFetch.push_back(GetBlockRequest(pfrom, inv.hash));
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        }
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(GetBlockRequest(pfrom, inv.hash));
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -5736,7 +6743,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -5768,7 +6775,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -5780,9 +6787,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         CBlockIndex* pindex = NULL;
         if (locator.IsNull()) {
-            // If locator is null, return the hashStop block
+            // If locator is null, return the hashStop block. Peers use this to find out whether we
+            // can serve that block, so only answer for blocks on our active chain.
             BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
+            if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
                 return true;
             pindex = (*mi).second;
         } else {
@@ -5964,7 +6972,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
+    else if (strCommand == "headers" && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
 
@@ -5983,6 +6991,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
+        // Only take headers in answer to our getheaders, otherwise any peer could fill mapBlockIndex with forged headers
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (!fHeadersFirstSync || nodestate->nHeadersRequested == 0) {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("unrequested headers from peer=%d", pfrom->id);
+        }
+        nodestate->nHeadersRequested--;
+
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
@@ -6012,12 +7028,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
+        // Ask the other headers-first peers whether they have pindexLast too, so the blocks up to it
+        // are downloaded from all of them rather than only from the peer that sent the headers.
+        // A single header (the answer to such a question) doesn't trigger another round.
+        if (fHeadersFirstSync && nCount > 1 && pindexLast && pindexLast->nChainWork > chainActive.Tip()->nChainWork) {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodes) {
+                if (pnode == pfrom || pnode->fDisconnect || pnode->fClient || pnode->nVersion < HEADERS_FIRST_VERSION)
+                    continue;
+                CNodeState* stateNode = State(pnode->GetId());
+                if (stateNode && (stateNode->pindexBestKnownBlock == NULL || stateNode->pindexBestKnownBlock->nChainWork < pindexLast->nChainWork))
+                    PushGetHeaders(pnode, CBlockLocator(), pindexLast->GetBlockHash());
+            }
+        }
+
         if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
             LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
-            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
+            PushGetHeaders(pfrom, chainActive.GetLocator(pindexLast), uint256(0));
         }
 
         CheckBlockIndex();
@@ -6027,41 +7057,169 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         CBlock block;
         vRecv >> block;
-        uint256 hashBlock = block.GetHash();
-        CInv inv(MSG_BLOCK, hashBlock);
-        LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
-
-        //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
-                //we already asked for this block, so lets work backwards and ask for the previous block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
-                pfrom->vBlockRequested.push_back(block.hashPrevBlock);
-            } else {
-                //ask to sync to this block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
-                pfrom->vBlockRequested.push_back(hashBlock);
+        ProcessBlockMessage(pfrom, block);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint("net", "received compact block %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "%s : Already processed block %s, skipping compact block\n", __func__, hashBlock.GetHex());
+                return true;
+            }
+
+            // Doesn't connect to anything we know, fetch the headers (or without headers-first the blocks) leading up to it first
+            if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+                if (fHeadersFirstSync && pfrom->nVersion >= HEADERS_FIRST_VERSION)
+                    PushGetHeaders(pfrom, chainActive.GetLocator(pindexBestHeader), uint256(0));
+                else
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
+                return true;
             }
-        } else {
-            pfrom->AddInventoryKnown(inv);
 
+            // The header is checked before any work goes into the transactions
+            CBlockIndex* pindex = NULL;
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
+            if (!AcceptBlockHeader(CBlock(cmpctblock.header), state, &pindex)) {
                 int nDoS;
-                if(state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if(nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header in compact block %s from peer=%d", hashBlock.ToString(), pfrom->id);
                 }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
-            } else {
-                LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+
+            // Only rebuild blocks we asked this peer for or that extend our tip, anything else is fetched in full
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hashBlock);
+            bool fRequested = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            if (!fRequested && pindex->pprev != chainActive.Tip()) {
+                if (itInFlight == mapBlocksInFlight.end()) {
+                    LogPrint("net", "compact block %s from peer=%d does not extend our tip, requesting full block\n", hashBlock.ToString(), pfrom->id);
+                    pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock)));
+                    MarkBlockAsInFlight(pfrom->GetId(), hashBlock, pindex);
+                }
+                return true;
+            }
+        }
+
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+        ReadStatus status = partialBlock->InitData(cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid compact block %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        }
+
+        BlockTransactionsRequest req;
+        req.blockhash = hashBlock;
+        if (status == READ_STATUS_OK) {
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+        }
+
+        CBlock block;
+        if (status == READ_STATUS_OK && req.indexes.empty()) {
+            std::vector<CTransaction> vtxMissing;
+            status = partialBlock->FillBlock(block, vtxMissing);
+        }
+
+        if (status == READ_STATUS_FAILED) {
+            // Short ID collision, fall back to the full block
+            LogPrint("net", "compact block %s from peer=%d could not be reconstructed, requesting full block\n", hashBlock.ToString(), pfrom->id);
+            pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock)));
+        } else if (!req.indexes.empty()) {
+            {
+                LOCK(cs_main);
+                CNodeState* state = State(pfrom->GetId());
+                state->partialBlock = partialBlock;
+                state->hashPartialBlock = hashBlock;
+            }
+            LogPrint("net", "requesting %u of %u transactions of compact block %s from peer=%d\n", req.indexes.size(), cmpctblock.BlockTxCount(), hashBlock.ToString(), pfrom->id);
+            pfrom->PushMessage("getblocktxn", req);
+        } else {
+            ProcessBlockMessage(pfrom, block);
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        CBlock block;
+        bool fFullBlock;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+                return true;
+            }
+            // Only blocks we would announce as compact blocks are served in parts, older ones go out in full
+            fFullBlock = chainActive.Height() - mi->second->nHeight > MAX_CMPCTBLOCK_DEPTH;
+            if (!fFullBlock && !ReadBlockFromDisk(block, mi->second))
+                assert(!"cannot load block from disk");
+        }
+
+        if (fFullBlock) {
+            LogPrint("net", "peer=%d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_CMPCTBLOCK_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            if (!state->partialBlock || state->hashPartialBlock != resp.blockhash) {
+                LogPrint("net", "peer=%d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
             }
+            partialBlock.swap(state->partialBlock);
+            state->hashPartialBlock = 0;
+        }
+
+        CBlock block;
+        ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+        if (status == READ_STATUS_INVALID) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("peer=%d sent us invalid compact block transactions for %s", pfrom->id, resp.blockhash.ToString());
+        } else if (status == READ_STATUS_FAILED) {
+            LogPrint("net", "compact block %s from peer=%d could not be reconstructed, requesting full block\n", resp.blockhash.ToString(), pfrom->id);
+            pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+        } else {
+            ProcessBlockMessage(pfrom, block);
         }
     }
 
@@ -6228,6 +7386,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             delete pfrom->pfilter;
             pfrom->pfilter = new CBloomFilter(filter);
             pfrom->pfilter->UpdateEmptyFull();
+            pfrom->fFilterLoaded = true;
         }
         pfrom->fRelayTxes = true;
     }
@@ -6258,6 +7417,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LOCK(pfrom->cs_filter);
         delete pfrom->pfilter;
         pfrom->pfilter = new CBloomFilter();
+        pfrom->fFilterLoaded = false;
         pfrom->fRelayTxes = true;
     }
 
@@ -6419,8 +7579,11 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator mi = pfrom->vRecvMsg.begin(); mi != it; ++mi)
+            pfrom->ReleaseRecvBuffer(*mi);
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
@@ -6532,10 +7695,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (fHeadersFirstSync && pto->nVersion >= HEADERS_FIRST_VERSION) {
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    PushGetHeaders(pto, chainActive.GetLocator(pindexStart), uint256(0));
+                } else {
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                }
             }
         }
 
@@ -6549,54 +7715,86 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        int64_t nTimeInvStart = GetTimeMicros();
+        uint64_t nInvSent = 0;
+        uint64_t nInvMessages = 0;
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
+            // Inventory queued for this peer alone (blocks, masternode data, ...) goes out right away
+            vInv.reserve(std::min<size_t>(pto->vInventoryToSend.size(), MAX_INV_BATCH));
             BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+                std::vector<unsigned char> vKey = CNode::InventoryKnownKey(inv);
+                if (pto->filterInventoryKnown.contains(vKey))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle) {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
-
-                    if (fTrickleWait) {
-                        vInvWait.push_back(inv);
+                pto->filterInventoryKnown.insert(vKey);
+                vInv.push_back(inv);
+                if (vInv.size() >= MAX_INV_BATCH) {
+                    pto->PushMessage("inv", vInv);
+                    nInvSent += vInv.size();
+                    nInvMessages++;
+                    vInv.clear();
+                }
+            }
+            pto->vInventoryToSend.clear();
+
+            // Relayed transactions trickle out in batches on a randomized per-peer timer to protect privacy
+            if (pto->nNextInvSend < nTimeInvStart || pto->fWhitelisted) {
+                pto->nNextInvSend = PoissonNextSend(nTimeInvStart, pto->fInbound ? INVENTORY_BROADCAST_INTERVAL : INVENTORY_BROADCAST_INTERVAL >> 1);
+                vector<CInv> vRelay;
+                uint64_t nMissed = GetRelayInventory(pto->nRelayInventoryCursor, vRelay);
+                if (nMissed > 0) {
+                    LogPrint("net", "peer=%d fell behind the relay queue, %d transactions not announced\n", pto->id, nMissed);
+                    CNode::RecordRelayDropped(nMissed);
+                }
+                LOCK(pto->cs_filter);
+                BOOST_FOREACH (const CInv& inv, vRelay) {
+                    if (!pto->fRelayTxes)
+                        break;
+                    std::vector<unsigned char> vKey = CNode::InventoryKnownKey(inv);
+                    if (pto->filterInventoryKnown.contains(vKey))
                         continue;
+                    // Only peers that loaded a filter of their own get the transactions matched against it
+                    if (pto->fFilterLoaded) {
+                        CTransaction tx;
+                        if (!mempool.lookup(inv.hash, tx) || !pto->pfilter->IsRelevantAndUpdate(tx))
+                            continue;
                     }
-                }
-
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
+                    pto->filterInventoryKnown.insert(vKey);
                     vInv.push_back(inv);
-                    if (vInv.size() >= 1000) {
+                    if (vInv.size() >= MAX_INV_BATCH) {
                         pto->PushMessage("inv", vInv);
+                        nInvSent += vInv.size();
+                        nInvMessages++;
                         vInv.clear();
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
-        if (!vInv.empty())
+        if (!vInv.empty()) {
             pto->PushMessage("inv", vInv);
+            nInvSent += vInv.size();
+            nInvMessages++;
+        }
+        CNode::RecordInvSent(nInvSent, nInvMessages, GetTimeMicros() - nTimeInvStart);
 
         // Detect whether we're stalling
         int64_t nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
-            // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
-            // should only happen during initial block download.
-            LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
-            pto->fDisconnect = true;
+            // the download window should be much larger than the to-be-downloaded set of blocks, so this
+            // should only happen during initial block download. Hand the blocks the peer holds up to the
+            // other peers and leave it out for a while; disconnect it if it keeps stalling.
+            if (++state.nDownloadStalls > MAX_BLOCK_DOWNLOAD_STALLS) {
+                LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
+                pto->fDisconnect = true;
+            } else {
+                LogPrintf("Peer=%d is stalling block download, reassigning %d blocks in flight\n", pto->id, state.nBlocksInFlight);
+                while (!state.vBlocksInFlight.empty())
+                    MarkBlockAsReceived(state.vBlocksInFlight.front().hash);
+                state.nStallingSince = 0;
+                state.nDownloadBackoffUntil = nNow + 1000000 * BLOCK_STALLING_BACKOFF * state.nDownloadStalls;
+            }
         }
         // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
         // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
@@ -6612,7 +7810,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER && state.nDownloadBackoffUntil < nNow) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
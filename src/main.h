@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -51,6 +52,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -64,6 +66,22 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
+/** Default for -compactblocks, requesting new blocks as header plus short transaction IDs */
+static const bool DEFAULT_COMPACT_BLOCKS = true;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, saving the mempool on shutdown and reloading it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 static const unsigned int MAX_ZEROCOIN_TX_SIZE = 150000;
@@ -91,10 +109,22 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -zkpthreads default (number of zerocoin serial number proof verification threads, 0 = auto) */
+static const int DEFAULT_ZKP_VERIFY_THREADS = 0;
+/** -importthreads default (number of threads deserializing and checking blocks during -reindex/-loadblock, 0 = auto) */
+static const int DEFAULT_IMPORT_THREADS = 0;
+/** Maximum number of raw block bytes the -reindex/-loadblock reader may queue ahead of the checking threads */
+static const unsigned int MAX_IMPORT_QUEUE_BYTES = 32 * 1024 * 1024;
+/** stdio buffer size used by the -reindex/-loadblock reader for read-ahead */
+static const unsigned int IMPORT_READ_BUFFER_SIZE = 8 * 1024 * 1024;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
-/** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
+/** Timeout in seconds during which a peer must stall block download progress before its blocks are reassigned. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Number of times a peer may stall block download and have its blocks reassigned before it is disconnected. */
+static const int MAX_BLOCK_DOWNLOAD_STALLS = 3;
+/** Seconds per stall a peer whose blocks were reassigned is left out of block download. */
+static const unsigned int BLOCK_STALLING_BACKOFF = 10;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
@@ -103,8 +133,14 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum total size of the blocks kept in memory while they wait for their parent during headers-first sync. */
+static const unsigned int MAX_BLOCKS_AWAITING_PARENT_SIZE = 64 * 1000000;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Number of serialized blocks kept in memory after being sent to a peer. */
+static const unsigned int MAX_RAW_BLOCK_CACHE_SIZE = 32;
+/** Minimum disk space for block and undo files that -prune may be configured with, in bytes. */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -142,6 +178,16 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+/** Sync headers from one peer first and download the blocks from all peers in parallel (-headersfirst). */
+extern bool fHeadersFirstSync;
+/** Request new blocks from capable peers as compact blocks (-compactblocks). */
+extern bool fCompactBlocks;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of bytes of block and undo files -prune tries to stay under. */
+extern uint64_t nPruneTarget;
 extern unsigned int nCoinCacheSize;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
@@ -189,9 +235,11 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pfrom   The node which we are receiving the block from; it is added to mapBlockSource and may be penalised if the block is invalid.
  * @param[in]   pblock  The block we want to process.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   fPreChecked  The merkle root, block signature and zerocoin mints were already verified by PreCheckBlock.
+ * @param[in]   fReleaseChildren  Also process the blocks that were parked waiting for this one.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL);
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL, bool fPreChecked = false, bool fReleaseChildren = true);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -200,8 +248,15 @@ FILE* OpenBlockFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char* prefix);
-/** Import blocks from an external file */
+/**
+ * Import blocks from an external file. Reading, deserializing plus the context-free
+ * checks, and connecting run as separate pipeline stages on their own threads.
+ */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
+/** Write the mempool with its prioritisation deltas to mempool.dat */
+void DumpMempool();
+/** Read mempool.dat back, revalidating every transaction through AcceptToMemoryPool */
+bool LoadMempool();
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -221,6 +276,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend proof checking thread */
+void ThreadZerocoinSpendCheck();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -254,10 +311,21 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
+/** Mark one block file as pruned: its blocks lose their data and undo flags and its file info is cleared. */
+void PruneOneBlockFile(const int fileNumber);
+/** Actually unlink the specified block and undo files. */
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
+/** Calculate the amount of disk space the block and undo files currently use. */
+uint64_t CalculateCurrentUsage();
 
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
+
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
@@ -351,10 +419,16 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+/**
+ * Context-independent validity checks. If pvZerocoinChecks is not NULL, zerocoin spend
+ * proofs are pushed onto it instead of being verified inline. fCheckZerocoinMints may only
+ * be false if the mints were already validated with CheckZerocoinMint.
+ */
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL, bool fCheckZerocoinMints = true);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
+/** Verify a batch of zerocoin spend proofs on the check queue workers, stopping at the first bad proof */
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx);
@@ -435,11 +509,41 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one zerocoin spend proof to be verified against the
+ * accumulator value its checksum refers to.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    std::shared_ptr<const libzerocoin::CoinSpend> spend;
+    libzerocoin::ZerocoinParams* params;
+    CBigNum bnAccumulatorValue;
+    uint256 txid;
+
+public:
+    CZerocoinSpendCheck() : params(NULL) {}
+    CZerocoinSpendCheck(const libzerocoin::CoinSpend& spendIn, libzerocoin::ZerocoinParams* paramsIn, const CBigNum& bnAccumulatorValueIn, const uint256& txidIn) : spend(std::make_shared<const libzerocoin::CoinSpend>(spendIn)),
+                                                                                                                                                              params(paramsIn), bnAccumulatorValue(bnAccumulatorValueIn), txid(txidIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        spend.swap(check.spend);
+        std::swap(params, check.params);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+        std::swap(txid, check.txid);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block's serialized bytes without deserializing it */
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -458,7 +562,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true, bool fCheckZerocoinMints = true);
+/** The expensive checks of CheckBlock that need no chain state: merkle root, block signature and zerocoin mints */
+bool PreCheckBlock(const CBlock& block, CValidationState& state);
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
 
 /** Context-dependent validity checks */
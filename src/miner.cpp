@@ -41,27 +41,6 @@ using namespace std;
 // ESCOcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
@@ -89,6 +68,55 @@ public:
     }
 };
 
+// Zerocoin spends get a priority from how long they have been waiting and
+// their value, so that they make it into the next block.
+static double GetZerocoinSpendPriority(const CTransaction& tx, unsigned int nTxSize)
+{
+    uint256 txid = tx.GetHash();
+    int64_t nTimeSeen = GetAdjustedTime();
+    auto it = mapZerocoinspends.find(txid);
+    if (it != mapZerocoinspends.end()) {
+        nTimeSeen = it->second;
+    } else {
+        //for some reason not in map, add it
+        mapZerocoinspends[txid] = nTimeSeen;
+    }
+
+    //Priority = (age^6+100000)*amount - gives higher priority to zpivs that have been in mempool long
+    //and higher priority to zpivs that are large in value
+    CAmount nTotalIn = tx.GetZerocoinSpent();
+    double nConfs = 100000;
+    double dPriority = 0;
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
+
+        // zESCO spends can have very large priority, use non-overflowing safe functions
+        dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
+        dPriority = double_safe_multiplication(dPriority, nTotalIn);
+    }
+    return tx.ComputePriority(dPriority, nTxSize);
+}
+
+// Priority and modified fee rate of a mempool entry at the height of the new block
+static TxPriority GetTxPriority(const CTxMemPoolEntry& entry, unsigned int nHeight)
+{
+    const CTransaction& tx = entry.GetTx();
+    double dPriority = tx.IsZerocoinSpend() ? GetZerocoinSpendPriority(tx, entry.GetTxSize()) : entry.GetPriority(nHeight);
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(tx.GetHash(), dPriorityDelta, nFeeDelta);
+    return TxPriority(dPriority + dPriorityDelta, CFeeRate(entry.GetModifiedFee(), entry.GetTxSize()), &tx);
+}
+
+static bool AllParentsInBlock(const CTxMemPool::setEntries& setParents, const set<uint256>& setInBlock)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter& itParent, setParents) {
+        if (!setInBlock.count(itParent->first))
+            return false;
+    }
+    return true;
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -179,144 +207,117 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
     {
         LOCK2(cs_main, mempool.cs);
+        int64_t nTimeStart = GetTimeMicros();
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
+        // Unconfirmed transactions in the memory pool often depend on other
+        // transactions in the memory pool. Those reached before all their
+        // mempool parents are in the block wait here until the last parent
+        // is added, which the mempool links tell without rescanning.
+        map<uint256, TxPriority> mapWaiting;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            uint256 txid = tx.GetHash();
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to zpivs that have been in mempool long
-                    //and higher priority to zpivs that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
+        // Collect transactions into block
+        uint64_t nBlockSize = 1000;
+        uint64_t nBlockTx = 0;
+        int nBlockSigOps = 100;
+        bool fSortedByFee = (nBlockPrioritySize <= 0);
 
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
+        TxPriorityCompare comparer(fSortedByFee);
 
-                    // zESCO spends can have very large priority, use non-overflowing safe functions
-                    dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-                    dPriority = double_safe_multiplication(dPriority, nTotalIn);
+        // The mempool keeps its fee rate index in mining order, so past the
+        // priority area transactions are taken straight from the top of it.
+        // Priority grows with the chain height and has no standing order; the
+        // priority area is still sorted here, but from the values cached in
+        // the mempool entries instead of looking up every input's coins.
+        vector<TxPriority> vecPriority;
+        if (!fSortedByFee) {
+            vecPriority.reserve(mempool.mapTx.size());
+            for (map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+                vecPriority.push_back(GetTxPriority(mi->second, nHeight));
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        }
+        CTxMemPool::indexed_by_score::const_iterator itScore = mempool.setTxByScore.begin();
 
-                    continue;
-                }
+        // Passed-over transactions whose mempool parents have since been added
+        vector<TxPriority> vecReady;
+        set<uint256> setConsidered;
+        set<uint256> setInBlock;
 
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
+        vector<CBigNum> vBlockSerials;
+        vector<CBigNum> vTxSerials;
+        while (true) {
+            if (!fSortedByFee && vecPriority.empty()) {
+                fSortedByFee = true;
+                comparer = TxPriorityCompare(fSortedByFee);
+                std::make_heap(vecReady.begin(), vecReady.end(), comparer);
+            }
 
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
+            // Take the best transaction from the ready heap or the main source
+            TxPriority candidate;
+            bool fFromReady;
+            if (!fSortedByFee) {
+                fFromReady = !vecReady.empty() && comparer(vecPriority.front(), vecReady.front());
+                if (!fFromReady) {
+                    candidate = vecPriority.front();
+                    std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    vecPriority.pop_back();
                 }
-
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (invalid_out::ContainsOutPoint(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
+            } else {
+                while (itScore != mempool.setTxByScore.end() && setConsidered.count((*itScore)->first))
+                    ++itScore;
+                if (itScore == mempool.setTxByScore.end() && vecReady.empty())
                     break;
+                fFromReady = !vecReady.empty();
+                if (itScore != mempool.setTxByScore.end()) {
+                    candidate = GetTxPriority((*itScore)->second, nHeight);
+                    fFromReady = fFromReady && comparer(candidate, vecReady.front());
+                    if (!fFromReady)
+                        ++itScore;
                 }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zESCO spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
+            if (fFromReady) {
+                candidate = vecReady.front();
+                std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+                vecReady.pop_back();
+            }
 
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
+            double dPriority = candidate.get<0>();
+            CFeeRate feeRate = candidate.get<1>();
+            const CTransaction& tx = *(candidate.get<2>());
+            const uint256& hash = tx.GetHash();
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+            if (!fFromReady && !setConsidered.insert(hash).second)
+                continue;
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+                continue;
+            if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+                continue;
 
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            if (!tx.IsZerocoinSpend()) {
+                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+                bool fInvalidInput = false;
+                for (const CTxIn& txin : tx.vin) {
+                    if (invalid_out::ContainsOutPoint(txin.prevout)) {
+                        LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+                        fInvalidInput = true;
+                        break;
+                    }
+                }
+                if (fInvalidInput)
+                    continue;
+            }
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            // Has to wait for dependencies
+            CTxMemPool::txiter itEntry = mempool.mapTx.find(hash);
+            if (!AllParentsInBlock(mempool.GetMemPoolParents(itEntry), setInBlock)) {
+                mapWaiting[hash] = candidate;
+                continue;
+            }
 
             // Size limits
             unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
@@ -330,7 +331,6 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
                 continue;
 
             // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
             double dPriorityDelta = 0;
             CAmount nFeeDelta = 0;
             mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
@@ -338,12 +338,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
                 continue;
 
             // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
+            // transactions; whatever is left is picked up from the fee rate index:
             if (!fSortedByFee &&
                 ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
                 fSortedByFee = true;
                 comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                vecPriority.clear();
+                std::make_heap(vecReady.begin(), vecReady.end(), comparer);
             }
 
             if (!view.HaveInputs(tx))
@@ -394,6 +395,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
             // Added
             pblock->vtx.push_back(tx);
+            setInBlock.insert(hash);
             pblocktemplate->vTxFees.push_back(nTxFees);
             pblocktemplate->vTxSigOps.push_back(nTxSigOps);
             nBlockSize += nTxSize;
@@ -409,17 +411,14 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
                     dPriority, feeRate.ToString(), tx.GetHash().ToString());
             }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
+            // Transactions that depend on this one can now be added as well
+            BOOST_FOREACH (const CTxMemPool::txiter& itChild, mempool.GetMemPoolChildren(itEntry)) {
+                map<uint256, TxPriority>::iterator itWaiting = mapWaiting.find(itChild->first);
+                if (itWaiting == mapWaiting.end() || !AllParentsInBlock(mempool.GetMemPoolParents(itChild), setInBlock))
+                    continue;
+                vecReady.push_back(itWaiting->second);
+                std::push_heap(vecReady.begin(), vecReady.end(), comparer);
+                mapWaiting.erase(itWaiting);
             }
         }
 
@@ -436,6 +435,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        LogPrint("bench", "  - Select %u of %u mempool transactions: %.2fms\n", nBlockTx, mempool.mapTx.size(), 0.001 * (GetTimeMicros() - nTimeStart));
 
         // Compute final coinbase transaction.
         pblock->vtx[0].vin[0].scriptSig = CScript() << nHeight << OP_0;
@@ -23,11 +23,16 @@
 #include "wallet.h"
 
 #ifdef WIN32
+#include <math.h>
 #include <string.h>
 #else
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -85,6 +90,7 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = 125;
+bool fUseEpoll = false;
 bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
@@ -94,6 +100,14 @@ deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
+// Relayed transactions waiting to be announced, shared by all peers. Each peer keeps
+// its own cursor into the queue and catches up on its trickle tick.
+static CCriticalSection cs_relayInventory;
+static deque<CInv> dequeRelayInventory;
+static uint64_t nRelayInventoryBegin = 0; // cursor value of dequeRelayInventory.front()
+static CRollingBloomFilter* pfilterRelayInventory = NULL;
+static int64_t nRelayInventoryFilterReset = 0;
+
 static deque<string> vOneShots;
 CCriticalSection cs_vOneShots;
 
@@ -107,6 +121,9 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
+#ifdef USE_EPOLL
+static int epollfd = -1;
+#endif
 boost::condition_variable messageHandlerCondition;
 
 // Signals for message handling
@@ -340,8 +357,11 @@ void AddressCurrentlyConnected(const CService& addr)
 
 uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
+std::atomic<size_t> CNode::nRecvBufferPoolTotalBytes(0);
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CRelayStats CNode::relayStats;
+CCriticalSection CNode::cs_relayStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -386,6 +406,24 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+static void AddNode(CNode* pnode)
+{
+    LOCK(cs_vNodes);
+    vNodes.push_back(pnode);
+#ifdef USE_EPOLL
+    // Registered only once the node is in vNodes, so the socket thread never sees a node it does not own
+    if (epollfd != -1 && pnode->hSocket != INVALID_SOCKET) {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = pnode;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+            LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+        }
+    }
+#endif
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMaster)
 {
     if (pszDest == NULL) {
@@ -414,7 +452,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!fUseEpoll && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -426,10 +464,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
 
-        {
-            LOCK(cs_vNodes);
-            vNodes.push_back(pnode);
-        }
+        AddNode(pnode);
 
         pnode->nTimeConnected = GetTime();
         if (obfuScationMaster) pnode->fObfuScationMaster = true;
@@ -449,6 +484,11 @@ void CNode::CloseSocketDisconnect()
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET) {
         LogPrint("net", "disconnecting peer=%d\n", id);
+#ifdef USE_EPOLL
+        // Closing is not enough when a forked child (e.g. -blocknotify) still shares the descriptor
+        if (epollfd != -1)
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
         CloseSocket(hSocket);
     }
 
@@ -718,7 +758,8 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         // absorb network data
         int handled;
-        if (!msg.in_data)
+        bool fHeader = !msg.in_data;
+        if (fHeader)
             handled = msg.readHeader(pch, nBytes);
         else
             handled = msg.readData(pch, nBytes);
@@ -731,6 +772,9 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
             return false;
         }
 
+        if (fHeader && msg.in_data)
+            AcquireRecvBuffer(msg);
+
         pch += handled;
         nBytes -= handled;
 
@@ -743,6 +787,50 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
     return true;
 }
 
+void CNode::AcquireRecvBuffer(CNetMessage& msg)
+{
+    if (vRecvBufferPool.empty())
+        return;
+
+    // Best fit: the smallest buffer that holds the whole payload, otherwise the largest one
+    unsigned int nSize = msg.hdr.nMessageSize;
+    std::vector<CSerializeData>::iterator itBest = vRecvBufferPool.begin();
+    for (std::vector<CSerializeData>::iterator it = vRecvBufferPool.begin() + 1; it != vRecvBufferPool.end(); ++it) {
+        if (itBest->capacity() < nSize) {
+            if (it->capacity() > itBest->capacity())
+                itBest = it;
+        } else if (it->capacity() >= nSize && it->capacity() < itBest->capacity())
+            itBest = it;
+    }
+
+    nRecvBufferPoolBytes -= itBest->capacity();
+    nRecvBufferPoolTotalBytes -= itBest->capacity();
+    msg.vRecv.swap(*itBest);
+    std::swap(*itBest, vRecvBufferPool.back());
+    vRecvBufferPool.pop_back();
+}
+
+void CNode::ReleaseRecvBuffer(CNetMessage& msg)
+{
+    CSerializeData vch;
+    msg.vRecv.swap(vch);
+    if (vch.capacity() == 0 || vRecvBufferPool.size() >= MAX_RECV_BUFFER_POOL_COUNT ||
+        nRecvBufferPoolBytes + vch.capacity() > MAX_RECV_BUFFER_POOL_BYTES)
+        return;
+
+    // Reserve the room in the budget shared by all peers first, other peers release concurrently
+    if (nRecvBufferPoolTotalBytes.fetch_add(vch.capacity()) + vch.capacity() > MAX_RECV_BUFFER_POOL_TOTAL_BYTES) {
+        nRecvBufferPoolTotalBytes -= vch.capacity();
+        return;
+    }
+
+    // Keep the allocation; the contents are only ever network data, so it is not wiped
+    vch.clear();
+    nRecvBufferPoolBytes += vch.capacity();
+    vRecvBufferPool.push_back(CSerializeData());
+    vRecvBufferPool.back().swap(vch);
+}
+
 int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -778,10 +866,7 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    reserveData(nCopy);
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
@@ -789,6 +874,19 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     return nCopy;
 }
 
+unsigned int CNetMessage::reserveData(unsigned int nMinBytes)
+{
+    unsigned int nRemaining = hdr.nMessageSize - nDataPos;
+    unsigned int nReserve = std::min(nRemaining, nMinBytes);
+
+    if (vRecv.size() < nDataPos + nReserve) {
+        // Allocate up to 256 KiB ahead, but never more than the total message size.
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nReserve + 256 * 1024));
+    }
+
+    return vRecv.size() - nDataPos;
+}
+
 
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
@@ -835,283 +933,466 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+// requires LOCK(cs_vRecvMsg)
+// Returns false once the socket has no more data to read right now or was closed.
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    char* pchDest = pchBuf;
+    unsigned int nSpace = sizeof(pchBuf);
+
+    // The bulk of a large message is received straight into its payload buffer
+    // instead of being copied there from pchBuf.
+    CNetMessage* pmsg = NULL;
+    if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.back().in_data && !pnode->vRecvMsg.back().complete()) {
+        CNetMessage& msg = pnode->vRecvMsg.back();
+        if (msg.hdr.nMessageSize - msg.nDataPos >= sizeof(pchBuf)) {
+            nSpace = msg.reserveData(sizeof(pchBuf));
+            pchDest = &msg.vRecv[msg.nDataPos];
+            pmsg = &msg;
+        }
+    }
+
+    int nBytes = recv(pnode->hSocket, pchDest, nSpace, MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (pmsg)
+            pmsg->nDataPos += nBytes;
+        else if (!pnode->ReceiveMsgBytes(pchBuf, nBytes)) {
+            pnode->CloseSocketDisconnect();
+            return false;
+        }
+        if (pmsg && pmsg->complete()) {
+            pmsg->nTime = GetTimeMicros();
+            messageHandlerCondition.notify_one();
+        }
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return true;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEINTR)
+            return true;
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+// requires LOCK(cs_vRecvMsg)
+// Whether there is room to receive more data; see the flow control comment in ServiceSocketsSelect.
+static bool CanReceiveMore(CNode* pnode)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    return pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+           pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+}
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+static void DisconnectNodes(unsigned int& nPrevNodeCount)
+{
+    //
+    // Disconnect nodes
+    //
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        size_t vNodesSize;
-        {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
-        }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!fUseEpoll && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        AddNode(pnode);
+    }
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+static void ServiceSocketsSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
 
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
             have_fds = true;
-        }
 
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && CanReceiveMore(pnode))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
+            }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
         }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec / 1000);
+    }
 
-        //
-        // Accept new connections
-        //
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            AcceptConnection(hListenSocket);
+    }
 
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
+    //
+    // Service each socket
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
+    BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+        boost::this_thread::interruption_point();
 
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
+        //
+        // Receive
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
+        }
 
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+        //
+        // Send
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
         }
 
         //
-        // Service each socket
+        // Inactivity checking
         //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy)
-                pnode->AddRef();
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodesCopy)
+            pnode->Release();
+    }
+}
+
+#ifdef USE_EPOLL
+// Listening sockets are registered with a pointer to their vhListenSocket entry, nodes with the CNode
+static const ListenSocket* GetListenSocket(const void* ptr)
+{
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket)
+        if (&hListenSocket == ptr)
+            return &hListenSocket;
+    return NULL;
+}
+
+/**
+ * Edge-triggered epoll loop. Only sockets that reported readiness (plus those
+ * left with work from the previous round in vNodesPending) are visited, so a
+ * wakeup costs O(active peers) instead of O(connected peers). Every node in
+ * vNodesPending holds a reference.
+ */
+static void ServiceSocketsEpoll(vector<CNode*>& vNodesPending, int64_t& nLastInactivityCheck)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            MilliSleep(50);
         }
-        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-            boost::this_thread::interruption_point();
+        nEvents = 0;
+    }
 
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
+    vector<CNode*> vNodesReady;
+    {
+        LOCK(cs_vNodes);
+        vector<CNode*> vNodesEvents;
+        vNodesEvents.swap(vNodesPending);
+        for (int i = 0; i < nEvents; i++) {
+            if (GetListenSocket(events[i].data.ptr))
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+            CNode* pnode = (CNode*)events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                pnode->fHasRecvData = true;
+            vNodesEvents.push_back(pnode->AddRef());
+        }
+        // A node can be both pending and signalled (more than once), only keep one reference
+        sort(vNodesEvents.begin(), vNodesEvents.end());
+        BOOST_FOREACH (CNode* pnode, vNodesEvents) {
+            if (!vNodesReady.empty() && vNodesReady.back() == pnode)
+                pnode->Release();
+            else
+                vNodesReady.push_back(pnode);
+        }
+    }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+    //
+    // Accept new connections
+    //
+    for (int i = 0; i < nEvents; i++) {
+        const ListenSocket* pListenSocket = GetListenSocket(events[i].data.ptr);
+        if (pListenSocket && pListenSocket->socket != INVALID_SOCKET)
+            AcceptConnection(*pListenSocket);
+    }
+
+    //
+    // Service each ready socket
+    //
+    BOOST_FOREACH (CNode* pnode, vNodesReady) {
+        boost::this_thread::interruption_point();
+        if (pnode->hSocket == INVALID_SOCKET) {
+            LOCK(cs_vNodes);
+            pnode->Release();
+            continue;
+        }
+
+        // Writes are driven by the queue: whatever is in vSendMsg goes out until the
+        // kernel buffer is full, the next EPOLLOUT edge brings us back here.
+        bool fSendPending = true;
+        bool fRetry = false;
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend) {
+                if (!pnode->vSendMsg.empty())
                     SocketSendData(pnode);
-            }
+                fSendPending = !pnode->vSendMsg.empty();
+            } else
+                fRetry = true;
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
+        // Same flow control as the select() loop: drain the send queue before reading more.
+        // Reads continue until the socket would block, as no new edge is reported before that.
+        if (pnode->fHasRecvData && !fSendPending) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv) {
+                while (pnode->fHasRecvData && pnode->hSocket != INVALID_SOCKET && CanReceiveMore(pnode))
+                    pnode->fHasRecvData = SocketRecvData(pnode);
             }
         }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodesCopy)
-                pnode->Release();
+
+        if (pnode->hSocket != INVALID_SOCKET && (pnode->fHasRecvData || fRetry)) {
+            // Keep the reference until the work left over can be done
+            vNodesPending.push_back(pnode);
+            continue;
         }
+        LOCK(cs_vNodes);
+        pnode->Release();
+    }
+
+    //
+    // Inactivity checking
+    //
+    int64_t nNow = GetTime();
+    if (nNow != nLastInactivityCheck) {
+        nLastInactivityCheck = nNow;
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            InactivityCheck(pnode);
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    vector<CNode*> vNodesPending;
+    int64_t nLastInactivityCheck = 0;
+#endif
+    while (true) {
+        DisconnectNodes(nPrevNodeCount);
+#ifdef USE_EPOLL
+        if (fUseEpoll) {
+            ServiceSocketsEpoll(vNodesPending, nLastInactivityCheck);
+            continue;
+        }
+#endif
+        ServiceSocketsSelect();
     }
 }
 
@@ -1744,6 +2025,26 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     Discover(threadGroup);
 
+#ifdef USE_EPOLL
+    if (fUseEpoll && epollfd == -1) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1 failed: %s, falling back to select()\n", NetworkErrorString(WSAGetLastError()));
+            fUseEpoll = false;
+        }
+        BOOST_FOREACH (ListenSocket& hListenSocket, vhListenSocket) {
+            if (epollfd == -1)
+                break;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &hListenSocket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+                LogPrintf("epoll_ctl failed for listening socket: %s\n", NetworkErrorString(WSAGetLastError()));
+        }
+    }
+    LogPrintf("Using %s for socket events\n", fUseEpoll ? "epoll" : "select");
+#endif
+
     //
     // Start threads
     //
@@ -1820,6 +2121,13 @@ public:
         semOutbound = NULL;
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
+        delete pfilterRelayInventory;
+        pfilterRelayInventory = NULL;
+#ifdef USE_EPOLL
+        if (epollfd != -1)
+            close(epollfd);
+        epollfd = -1;
+#endif
 
 #ifdef WIN32
         // Shutdown Windows Sockets
@@ -1846,6 +2154,7 @@ void RelayTransaction(const CTransaction& tx)
 
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
+    int64_t nTimeStart = GetTimeMicros();
     CInv inv(MSG_TX, tx.GetHash());
     {
         LOCK(cs_mapRelay);
@@ -1859,17 +2168,55 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         mapRelay.insert(std::make_pair(inv, ss));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
-    LOCK(cs_vNodes);
-    BOOST_FOREACH (CNode* pnode, vNodes) {
-        if (!pnode->fRelayTxes)
-            continue;
-        LOCK(pnode->cs_filter);
-        if (pnode->pfilter) {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
-                pnode->PushInventory(inv);
-        } else
-            pnode->PushInventory(inv);
+
+    // Queue the announcement once for everybody instead of visiting every peer; per-peer
+    // relay and bloom filters are applied when SendMessages drains the queue. Anything
+    // queued within the mapRelay lifetime is a duplicate, later relays (e.g. wallet
+    // rebroadcasts) go out again.
+    bool fDuplicate = true;
+    {
+        LOCK(cs_relayInventory);
+        if (!pfilterRelayInventory)
+            pfilterRelayInventory = new CRollingBloomFilter(RELAY_INVENTORY_QUEUE_SIZE, 0.000001);
+        if (nRelayInventoryFilterReset < GetTime()) {
+            pfilterRelayInventory->reset();
+            nRelayInventoryFilterReset = GetTime() + 15 * 60;
+        }
+        if (!pfilterRelayInventory->contains(inv.hash)) {
+            pfilterRelayInventory->insert(inv.hash);
+            dequeRelayInventory.push_back(inv);
+            if (dequeRelayInventory.size() > RELAY_INVENTORY_QUEUE_SIZE) {
+                dequeRelayInventory.pop_front();
+                nRelayInventoryBegin++;
+            }
+            fDuplicate = false;
+        }
     }
+    CNode::RecordRelayQueued(fDuplicate, GetTimeMicros() - nTimeStart);
+}
+
+uint64_t GetRelayInventory(uint64_t& nCursor, std::vector<CInv>& vInv)
+{
+    LOCK(cs_relayInventory);
+    uint64_t nMissed = 0;
+    if (nCursor < nRelayInventoryBegin) {
+        nMissed = nRelayInventoryBegin - nCursor;
+        nCursor = nRelayInventoryBegin;
+    }
+    vInv.insert(vInv.end(), dequeRelayInventory.begin() + (nCursor - nRelayInventoryBegin), dequeRelayInventory.end());
+    nCursor = nRelayInventoryBegin + dequeRelayInventory.size();
+    return nMissed;
+}
+
+uint64_t GetRelayInventoryEnd()
+{
+    LOCK(cs_relayInventory);
+    return nRelayInventoryBegin + dequeRelayInventory.size();
+}
+
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
 }
 
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
@@ -1920,6 +2267,36 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+void CNode::RecordRelayQueued(bool fDuplicate, int64_t nTimeMicros)
+{
+    LOCK(cs_relayStats);
+    if (fDuplicate)
+        relayStats.nDuplicates++;
+    else
+        relayStats.nQueued++;
+    relayStats.nRelayMicros += nTimeMicros;
+}
+
+void CNode::RecordRelayDropped(uint64_t nItems)
+{
+    LOCK(cs_relayStats);
+    relayStats.nDropped += nItems;
+}
+
+void CNode::RecordInvSent(uint64_t nItems, uint64_t nMessages, int64_t nTimeMicros)
+{
+    LOCK(cs_relayStats);
+    relayStats.nAnnounced += nItems;
+    relayStats.nInvMessages += nMessages;
+    relayStats.nSendMicros += nTimeMicros;
+}
+
+CRelayStats CNode::GetRelayStats()
+{
+    LOCK(cs_relayStats);
+    return relayStats;
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -2051,7 +2428,7 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000), filterInventoryKnown(INVENTORY_KNOWN_SIZE, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2073,6 +2450,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fHasRecvData = false;
+    nRecvBufferPoolBytes = 0;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2080,8 +2459,10 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
+    nRelayInventoryCursor = GetRelayInventoryEnd();
+    nNextInvSend = 0;
     pfilter = new CBloomFilter();
+    fFilterLoaded = false;
     nPingNonceSent = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
@@ -2109,6 +2490,8 @@ CNode::~CNode()
 {
     CloseSocket(hSocket);
 
+    nRecvBufferPoolTotalBytes -= nRecvBufferPoolBytes;
+
     if (pfilter)
         delete pfilter;
 
@@ -21,6 +21,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -52,6 +53,12 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Number of processed message buffers a peer keeps around for reuse. */
+static const unsigned int MAX_RECV_BUFFER_POOL_COUNT = 4;
+/** Total capacity of the buffers a peer keeps around for reuse (enough for one maximum sized message). */
+static const size_t MAX_RECV_BUFFER_POOL_BYTES = MAX_PROTOCOL_MESSAGE_LENGTH;
+/** Total capacity of the buffers all peers together keep around for reuse, so idle connections cannot pin memory without bound. */
+static const size_t MAX_RECV_BUFFER_POOL_TOTAL_BYTES = 32 * MAX_PROTOCOL_MESSAGE_LENGTH;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -60,6 +67,24 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** -socketevents default */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** The maximum number of socket events handled per epoll_wait() call */
+static const int MAX_EPOLL_EVENTS = 256;
+/** The maximum number of inventory items queued for a single peer before new ones are dropped. */
+static const unsigned int MAX_INV_TO_SEND = MAX_INV_SZ;
+/** The maximum number of entries in an 'inv' message we generate ourselves. */
+static const unsigned int MAX_INV_BATCH = 1000;
+/** Number of recently announced or received inventory hashes remembered per peer. */
+static const unsigned int INVENTORY_KNOWN_SIZE = 5000;
+/** Number of relayed transactions kept in the shared announcement queue for peers to catch up on. */
+static const unsigned int RELAY_INVENTORY_QUEUE_SIZE = 50000;
+/** Average delay between trickled transaction announcements to an inbound peer (in seconds); outbound peers get half. */
+static const int INVENTORY_BROADCAST_INTERVAL = 5;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 
@@ -129,6 +154,7 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern bool fUseEpoll;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -173,6 +199,17 @@ public:
     std::string addrLocal;
 };
 
+/** Cost of transaction and inventory relay since startup */
+struct CRelayStats {
+    uint64_t nQueued;      //! transactions added to the shared relay queue
+    uint64_t nDuplicates;  //! relays skipped because the transaction was already queued
+    uint64_t nDropped;     //! announcements lost to a full peer queue or a peer falling behind
+    uint64_t nAnnounced;   //! inventory entries sent in inv messages
+    uint64_t nInvMessages; //! inv messages sent
+    int64_t nRelayMicros;  //! time spent queueing relayed transactions
+    int64_t nSendMicros;   //! time spent assembling inv batches
+};
+
 
 class CNetMessage
 {
@@ -212,6 +249,8 @@ public:
 
     int readHeader(const char* pch, unsigned int nBytes);
     int readData(const char* pch, unsigned int nBytes);
+    // Grow vRecv so at least nMinBytes (bounded by the message size) can be received at nDataPos; returns the space available there
+    unsigned int reserveData(unsigned int nMinBytes);
 };
 
 
@@ -293,6 +332,9 @@ public:
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
+    // Payload buffers of processed messages, handed to the next ones received (requires cs_vRecvMsg)
+    std::vector<CSerializeData> vRecvBufferPool;
+    size_t nRecvBufferPoolBytes;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
@@ -317,6 +359,8 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // The socket may have unread data (epoll only: edge-triggered readiness is not reported again until it is drained)
+    bool fHasRecvData;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -331,6 +375,8 @@ public:
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
+    // Whether the peer loaded a bloom filter of its own, pfilter is never null
+    bool fFilterLoaded;
     int nRefCount;
     NodeId id;
 
@@ -362,9 +408,13 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    // Position in the shared relayed-transaction queue up to which this peer has been served
+    uint64_t nRelayInventoryCursor;
+    // When the next batch of relayed transactions is announced (in usec)
+    int64_t nNextInvSend;
     std::multimap<int64_t, CInv> mapAskFor;
     std::vector<uint256> vBlockRequested;
 
@@ -388,6 +438,13 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Capacity of the receive buffer pools of all peers, see MAX_RECV_BUFFER_POOL_TOTAL_BYTES
+    static std::atomic<size_t> nRecvBufferPoolTotalBytes;
+
+    // Inventory relay stats
+    static CCriticalSection cs_relayStats;
+    static CRelayStats relayStats;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -415,6 +472,12 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char* pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    void AcquireRecvBuffer(CNetMessage& msg);
+
+    // requires LOCK(cs_vRecvMsg)
+    void ReleaseRecvBuffer(CNetMessage& msg);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -455,11 +518,20 @@ public:
     }
 
 
+    // Key of an inventory item in filterInventoryKnown, a SwiftX lock request has the hash of its transaction
+    static std::vector<unsigned char> InventoryKnownKey(const CInv& inv)
+    {
+        std::vector<unsigned char> vKey(inv.hash.begin(), inv.hash.end());
+        for (int i = 0; i < 4; i++)
+            vKey.push_back((inv.type >> (8 * i)) & 0xff);
+        return vKey;
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(InventoryKnownKey(inv));
         }
     }
 
@@ -467,8 +539,13 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            if (filterInventoryKnown.contains(InventoryKnownKey(inv)))
+                return;
+            if (vInventoryToSend.size() >= MAX_INV_TO_SEND) {
+                RecordRelayDropped(1);
+                return;
+            }
+            vInventoryToSend.push_back(inv);
         }
     }
 
@@ -727,6 +804,12 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Inventory relay stats
+    static void RecordRelayQueued(bool fDuplicate, int64_t nTimeMicros);
+    static void RecordRelayDropped(uint64_t nItems);
+    static void RecordInvSent(uint64_t nItems, uint64_t nMessages, int64_t nTimeMicros);
+    static CRelayStats GetRelayStats();
 };
 
 class CExplicitNetCleanup
@@ -740,6 +823,12 @@ void RelayTransaction(const CTransaction& tx);
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll = false);
 void RelayInv(CInv& inv);
+/** Hand out the relayed transactions queued since nCursor and advance it. Returns the number of entries the peer fell too far behind to see. */
+uint64_t GetRelayInventory(uint64_t& nCursor, std::vector<CInv>& vInv);
+/** Cursor value of a peer that is up to date with the relayed transaction queue. */
+uint64_t GetRelayInventoryEnd();
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
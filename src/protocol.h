@@ -173,7 +173,10 @@ enum {
     MSG_MASTERNODE_QUORUM,
     MSG_MASTERNODE_ANNOUNCE,
     MSG_MASTERNODE_PING,
-    MSG_DSTX
+    MSG_DSTX,
+    // Only requested in getdata; the reply is a "cmpctblock" message
+    // (or a plain "block" if the block is too deep to be worth encoding).
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -9,6 +9,7 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "kernel.h"
 #include "main.h"
 #include "masternode-sync.h"
 #include "net.h"
@@ -581,6 +582,12 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"stakemodifiercache\": {           (json object) cache of stake modifiers resolved for staking and validation\n"
+            "    \"size\": xxxxx,                  (numeric) Number of stake modifiers cached\n"
+            "    \"hits\": xxxxx,                  (numeric) Lookups answered from the cache\n"
+            "    \"misses\": xxxxx,                (numeric) Lookups that walked the chain\n"
+            "    \"hitrate\": x.xxx                (numeric) Fraction of lookups answered from the cache\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -609,6 +616,15 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
 
+    UniValue cacheObj(UniValue::VOBJ);
+    uint64_t nHits = stakeModifierCache.GetHits();
+    uint64_t nLookups = nHits + stakeModifierCache.GetMisses();
+    cacheObj.push_back(Pair("size", (int64_t)stakeModifierCache.Size()));
+    cacheObj.push_back(Pair("hits", nHits));
+    cacheObj.push_back(Pair("misses", nLookups - nHits));
+    cacheObj.push_back(Pair("hitrate", nLookups ? (double)nHits / nLookups : 0.0));
+    obj.push_back(Pair("stakemodifiercache", cacheObj));
+
     return obj;
 }
 #endif // ENABLE_WALLET
@@ -349,13 +349,22 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
         throw runtime_error(
             "getnettotals\n"
             "\nReturns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.\n"
+            "inventory relay and current time.\n"
 
             "\nResult:\n"
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"relay\": {             (json object) Inventory relay since startup\n"
+            "    \"txqueued\": n,       (numeric) Transactions queued for announcement to peers\n"
+            "    \"txduplicates\": n,   (numeric) Relays skipped because the transaction was queued recently\n"
+            "    \"invdropped\": n,     (numeric) Announcements dropped by full or lagging peer queues\n"
+            "    \"invannounced\": n,   (numeric) Inventory entries announced to peers\n"
+            "    \"invmessages\": n,    (numeric) inv messages sent\n"
+            "    \"relaytimemicros\": n, (numeric) Time spent queueing relayed transactions\n"
+            "    \"sendtimemicros\": n   (numeric) Time spent assembling inv batches\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -365,6 +374,17 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    CRelayStats relayStats = CNode::GetRelayStats();
+    UniValue relay(UniValue::VOBJ);
+    relay.push_back(Pair("txqueued", relayStats.nQueued));
+    relay.push_back(Pair("txduplicates", relayStats.nDuplicates));
+    relay.push_back(Pair("invdropped", relayStats.nDropped));
+    relay.push_back(Pair("invannounced", relayStats.nAnnounced));
+    relay.push_back(Pair("invmessages", relayStats.nInvMessages));
+    relay.push_back(Pair("relaytimemicros", relayStats.nRelayMicros));
+    relay.push_back(Pair("sendtimemicros", relayStats.nSendMicros));
+    obj.push_back(Pair("relay", relay));
     return obj;
 }
 
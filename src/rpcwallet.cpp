@@ -48,6 +48,24 @@ void EnsureWalletIsUnlocked(bool fAllowAnonOnly)
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Please enter the wallet passphrase with walletpassphrase first.");
 }
 
+void EnsureWalletIsNotScanning()
+{
+    if (pwalletMain->IsScanning())
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: Wallet is currently rescanning. Abort the rescan with abortrescan or wait for it to finish.");
+}
+
+void RescanWallet(CBlockIndex* pindexStart, bool fUpdate)
+{
+    if (!pindexStart) {
+        LOCK(cs_main);
+        pindexStart = chainActive.Genesis();
+    }
+    if (pwalletMain->ScanForWalletTransactions(pindexStart, fUpdate) < 0)
+        EnsureWalletIsNotScanning();
+    if (pwalletMain->IsAbortingRescan())
+        throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted by user.");
+}
+
 void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
 {
     int confirms = wtx.GetDepthInMainChain(false);
@@ -2120,6 +2138,11 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
+            "  \"scanning\":                 (json object) current rescan details, or false if no rescan is running\n"
+            "    {\n"
+            "      \"duration\": xxxx,         (numeric) elapsed seconds since the rescan started\n"
+            "      \"progress\": x.xxxx,       (numeric) rescan progress, from 0 to 1\n"
+            "    }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -2135,9 +2158,41 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("keypoolsize", (int)pwalletMain->GetKeyPoolSize()));
     if (pwalletMain->IsCrypted())
         obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
+    if (pwalletMain->IsScanning()) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", pwalletMain->ScanningDuration() / 1000));
+        scanning.push_back(Pair("progress", pwalletMain->ScanningProgress()));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
+UniValue abortrescan(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "\nStops the current wallet rescan triggered by an RPC call, e.g. by an importprivkey call.\n"
+
+            "\nResult:\n"
+            "true|false    (boolean) Whether a rescan was running and has been told to stop\n"
+
+            "\nExamples:\n"
+            "\nImport a private key\n" +
+            HelpExampleCli("importprivkey", "\"mykey\"") +
+            "\nAbort the running wallet rescan\n" +
+            HelpExampleCli("abortrescan", "") +
+            "\nAs a JSON-RPC call\n" +
+            HelpExampleRpc("abortrescan", ""));
+
+    if (!pwalletMain->IsScanning() || pwalletMain->IsAbortingRescan())
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
+
 // ppcoin: reserve balance from being staked for network protection
 UniValue reservebalance(const UniValue& params, bool fHelp)
 {
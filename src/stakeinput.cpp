@@ -169,32 +169,48 @@ bool CZPivStake::MarkSpent(CWallet *pwallet, const uint256& txid)
 bool CPivStake::SetInput(CTransaction txPrev, unsigned int n)
 {
     this->txFrom = txPrev;
+    this->hashTxFrom = txPrev.GetHash();
     this->nPosition = n;
+    this->txOutFrom = txPrev.vout[n];
+    return true;
+}
+
+//Set from an unspent output alone, for when the block holding its transaction has been pruned,
+//or when the caller already knows the block it was confirmed in (the wallet's stake set)
+bool CPivStake::SetPrevout(const COutPoint& prevout, const CTxOut& txOut, CBlockIndex* pindexFromIn)
+{
+    this->txFrom = CTransaction();
+    this->hashTxFrom = prevout.hash;
+    this->nPosition = prevout.n;
+    this->txOutFrom = txOut;
+    this->pindexFrom = pindexFromIn;
     return true;
 }
 
 bool CPivStake::GetTxFrom(CTransaction& tx)
 {
+    if (txFrom.IsNull())
+        return false;
     tx = txFrom;
     return true;
 }
 
 bool CPivStake::CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut)
 {
-    txIn = CTxIn(txFrom.GetHash(), nPosition);
+    txIn = CTxIn(hashTxFrom, nPosition);
     return true;
 }
 
 CAmount CPivStake::GetValue()
 {
-    return txFrom.vout[nPosition].nValue;
+    return txOutFrom.nValue;
 }
 
 bool CPivStake::CreateTxOuts(CWallet* pwallet, vector<CTxOut>& vout, CAmount nTotal)
 {
     vector<valtype> vSolutions;
     txnouttype whichType;
-    CScript scriptPubKeyKernel = txFrom.vout[nPosition].scriptPubKey;
+    CScript scriptPubKeyKernel = txOutFrom.scriptPubKey;
     if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
         LogPrintf("CreateCoinStake : failed to parse kernel\n");
         return false;
@@ -243,24 +259,34 @@ CDataStream CPivStake::GetUniqueness()
 {
     //The unique identifier for a ESCO stake is the outpoint
     CDataStream ss(SER_NETWORK, 0);
-    ss << nPosition << txFrom.GetHash();
+    ss << nPosition << hashTxFrom;
     return ss;
 }
 
 //The block that the UTXO was added to the chain
 CBlockIndex* CPivStake::GetIndexFrom()
 {
+    // Set by the wallet, no need to look the transaction up again
+    if (pindexFrom && chainActive.Contains(pindexFrom))
+        return pindexFrom;
+
     uint256 hashBlock = 0;
     CTransaction tx;
-    if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
+    if (GetTransaction(hashTxFrom, tx, hashBlock, true)) {
         // If the index is in the chain, then set it as the "index from"
         if (mapBlockIndex.count(hashBlock)) {
             CBlockIndex* pindex = mapBlockIndex.at(hashBlock);
             if (chainActive.Contains(pindex))
                 pindexFrom = pindex;
         }
+    } else if (fHavePruned) {
+        // The transaction's block was pruned, its unspent outputs still record the height it was added at
+        LOCK(cs_main);
+        CCoins coins;
+        if (pcoinsTip->GetCoins(hashTxFrom, coins) && coins.nHeight <= chainActive.Height())
+            pindexFrom = chainActive[coins.nHeight];
     } else {
-        LogPrintf("%s : failed to find tx %s\n", __func__, txFrom.GetHash().GetHex());
+        LogPrintf("%s : failed to find tx %s\n", __func__, hashTxFrom.GetHex());
     }
 
     return pindexFrom;
@@ -67,8 +67,10 @@ public:
 class CPivStake : public CStakeInput
 {
 private:
-    CTransaction txFrom;
+    CTransaction txFrom; //! null when set with SetPrevout
+    uint256 hashTxFrom;
     unsigned int nPosition;
+    CTxOut txOutFrom;
 public:
     CPivStake()
     {
@@ -76,6 +78,7 @@ public:
     }
 
     bool SetInput(CTransaction txPrev, unsigned int n);
+    bool SetPrevout(const COutPoint& prevout, const CTxOut& txOut, CBlockIndex* pindexFromIn = nullptr);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) override;
@@ -125,6 +125,12 @@ public:
         vch.clear();
         nReadPos = 0;
     }
+    //! Exchange the underlying buffer with vchOther (e.g. to recycle its allocation); rewinds the stream
+    void swap(vector_type& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
     iterator insert(iterator it, const char& x = char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
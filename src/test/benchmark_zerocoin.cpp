@@ -20,6 +20,7 @@
 #include <exception>
 #include <cstdlib>
 #include <sys/time.h>
+#include <boost/thread.hpp>
 #include "streams.h"
 #include "libzerocoin/ParamGeneration.h"
 #include "libzerocoin/Denominations.h"
@@ -230,6 +231,59 @@ Testb_ParamGen()
 	return result;
 }
 
+bool
+Testb_FixedBaseExpMatchesPowMod()
+{
+	const uint32_t nRounds = 200;
+	struct {
+		const char* name;
+		const IntegerGroupParams* group;
+		CBigNum modulus;
+	} bases[] = {
+		{"coinCommitmentGroup", &gg_Params->coinCommitmentGroup, gg_Params->coinCommitmentGroup.modulus},
+		{"serialNumberSoKCommitmentGroup", &gg_Params->serialNumberSoKCommitmentGroup, gg_Params->serialNumberSoKCommitmentGroup.modulus},
+		{"accumulatorPoKCommitmentGroup", &gg_Params->accumulatorParams.accumulatorPoKCommitmentGroup, gg_Params->accumulatorParams.accumulatorPoKCommitmentGroup.modulus},
+		{"accumulatorQRNCommitmentGroup", &gg_Params->accumulatorParams.accumulatorQRNCommitmentGroup, gg_Params->accumulatorParams.accumulatorModulus},
+	};
+
+	try {
+		for (const auto& base : bases) {
+			vector<CBigNum> exponents;
+			for (uint32_t i = 0; i < nRounds; i++)
+				exponents.push_back(CBigNum::randBignum(base.modulus));
+
+			vector<CBigNum> vGeneric, vFixed;
+
+			timer.start();
+			for (const CBigNum& e : exponents)
+				vGeneric.push_back(base.group->g.pow_mod(e, base.modulus));
+			timer.stop();
+			int nGeneric = timer.duration();
+
+			timer.start();
+			for (const CBigNum& e : exponents)
+				vFixed.push_back(base.group->gPow(e, base.modulus));
+			timer.stop();
+			int nFixed = timer.duration();
+
+			cout << "\t" << base.name << " (" << base.modulus.bitSize() << " bit modulus, " << nRounds << " exponentiations):" << endl;
+			cout << "\t\tpow_mod: " << nGeneric << " ms\tfixed-base: " << nFixed << " ms";
+			if (nFixed > 0)
+				cout << "\tspeedup: " << (double)nGeneric / nFixed << "x";
+			cout << endl;
+
+			// The timings are only reported, what has to hold is that both agree
+			if (vFixed != vGeneric)
+				return false;
+		}
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
 bool
 Testb_Accumulator()
 {
@@ -370,6 +424,55 @@ Testb_MintAndSpend()
 	return false;
 }
 
+bool
+Testb_ParallelSpendVerify()
+{
+	try {
+		if (ggCoins[0] == NULL) {
+			Testb_MintCoin();
+			if (ggCoins[0] == NULL) {
+				return false;
+			}
+		}
+
+		Accumulator acc(&gg_Params->accumulatorParams,CoinDenomination::ZQ_ONE);
+		AccumulatorWitness wAcc(gg_Params, acc, ggCoins[0]->getPublicCoin());
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			acc += ggCoins[i]->getPublicCoin();
+			wAcc += ggCoins[i]->getPublicCoin();
+		}
+
+		CoinSpend spend(gg_Params, gg_Params, *(ggCoins[0]), acc, 0, wAcc, 0, SpendType::SPEND);
+
+		unsigned int nSavedThreads = SerialNumberSignatureOfKnowledge::GetVerifyThreads();
+		unsigned int nMaxThreads = std::max(2u, std::min(boost::thread::hardware_concurrency(), (unsigned int)ZEROCOIN_MAX_VERIFY_THREADS));
+		int nBaseline = 0;
+		bool ret = true;
+
+		for (unsigned int nThreads = 1; nThreads <= nMaxThreads; nThreads++) {
+			SerialNumberSignatureOfKnowledge::SetVerifyThreads(nThreads);
+
+			timer.start();
+			ret &= spend.Verify(acc);
+			timer.stop();
+
+			if (nThreads == 1)
+				nBaseline = timer.duration();
+
+			cout << "\tSPEND VERIFY (" << nThreads << " threads) ELAPSED TIME: " << timer.duration() << " ms\t";
+			if (timer.duration() > 0)
+				cout << "speedup: " << (double)nBaseline / timer.duration() << "x";
+			cout << endl;
+		}
+
+		SerialNumberSignatureOfKnowledge::SetVerifyThreads(nSavedThreads);
+		return ret;
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+}
+
 void
 Testb_RunAllTests()
 {
@@ -386,9 +489,11 @@ Testb_RunAllTests()
 	gLogTestResult("parameter sizes are correct", Testb_CalcParamSizes);
 	gLogTestResult("group/field parameters can be generated", Testb_GenerateGroupParams);
 	gLogTestResult("parameter generation is correct", Testb_ParamGen);
+	gLogTestResult("fixed-base exponentiation matches pow_mod", Testb_FixedBaseExpMatchesPowMod);
 	gLogTestResult("coins can be minted", Testb_MintCoin);
 	gLogTestResult("the accumulator works", Testb_Accumulator);
 	gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+	gLogTestResult("a spend verifies in parallel", Testb_ParallelSpendVerify);
 
 	// Summarize test results
 	if (ggSuccessfulTests < ggNumTests) {
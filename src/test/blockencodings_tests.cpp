@@ -0,0 +1,218 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+//! A coinbase followed by three transactions spending each other
+static CBlock BuildBlockTestCase()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(4);
+    block.vtx[0] = tx;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = block.vtx[2].GetHash();
+    block.vtx[3] = tx;
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+//! Same wire format as CBlockHeaderAndShortTxIDs, with everything open for the tests to break
+class TestHeaderAndShortIDs
+{
+public:
+    CBlockHeader header;
+    uint64_t nonce;
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+    std::vector<unsigned char> vchBlockSig;
+
+    TestHeaderAndShortIDs(const CBlock& block)
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << CBlockHeaderAndShortTxIDs(block);
+        stream >> *this;
+    }
+
+    CBlockHeaderAndShortTxIDs ToCompactBlock() const
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << *this;
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        stream >> cmpctblock;
+        return cmpctblock;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, header, nType, nVersion);
+        ::Serialize(s, nonce, nType, nVersion);
+        WriteCompactSize(s, shorttxids.size());
+        for (size_t i = 0; i < shorttxids.size(); i++) {
+            uint32_t lsb = shorttxids[i] & 0xffffffff;
+            uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+            ::Serialize(s, lsb, nType, nVersion);
+            ::Serialize(s, msb, nType, nVersion);
+        }
+        ::Serialize(s, prefilledtxn, nType, nVersion);
+        ::Serialize(s, vchBlockSig, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, header, nType, nVersion);
+        ::Unserialize(s, nonce, nType, nVersion);
+        shorttxids.resize(ReadCompactSize(s));
+        for (size_t i = 0; i < shorttxids.size(); i++) {
+            uint32_t lsb;
+            uint16_t msb;
+            ::Unserialize(s, lsb, nType, nVersion);
+            ::Unserialize(s, msb, nType, nVersion);
+            shorttxids[i] = (uint64_t(msb) << 32) | uint64_t(lsb);
+        }
+        ::Unserialize(s, prefilledtxn, nType, nVersion);
+        ::Unserialize(s, vchBlockSig, nType, nVersion);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // tx[3] is in the mempool, tx[1] and tx[2] are not
+    pool.addUnchecked(block.vtx[3].GetHash(), CTxMemPoolEntry(block.vtx[3], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << cmpctblock;
+    CBlockHeaderAndShortTxIDs cmpctblockRead;
+    stream >> cmpctblockRead;
+    BOOST_CHECK_EQUAL(cmpctblockRead.BlockTxCount(), 4);
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblockRead) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(partialBlock.IsTxAvailable(3));
+
+    // Too few or too many missing transactions is the peer's fault
+    CBlock blockRebuilt;
+    std::vector<CTransaction> vtxMissing;
+    vtxMissing.push_back(block.vtx[1]);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, vtxMissing) == READ_STATUS_INVALID);
+    vtxMissing.push_back(block.vtx[2]);
+    vtxMissing.push_back(block.vtx[2]);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, vtxMissing) == READ_STATUS_INVALID);
+
+    // The wrong transactions don't match the merkle root
+    vtxMissing.clear();
+    vtxMissing.push_back(block.vtx[2]);
+    vtxMissing.push_back(block.vtx[1]);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, vtxMissing) == READ_STATUS_FAILED);
+
+    vtxMissing.clear();
+    vtxMissing.push_back(block.vtx[1]);
+    vtxMissing.push_back(block.vtx[2]);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, vtxMissing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(blockRebuilt.GetHash().ToString(), block.GetHash().ToString());
+    BOOST_CHECK_EQUAL(blockRebuilt.BuildMerkleTree().ToString(), block.hashMerkleRoot.ToString());
+}
+
+BOOST_AUTO_TEST_CASE(ShortIDCollisionTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // Two transactions of the block sharing a short ID can't be told apart, get the full block
+    TestHeaderAndShortIDs shortIDs(block);
+    shortIDs.shorttxids[1] = shortIDs.shorttxids[0];
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs.ToCompactBlock()) == READ_STATUS_FAILED);
+
+    // A mempool transaction matching the short ID of another one is only caught by the merkle root
+    CMutableTransaction txOther(block.vtx[3]);
+    txOther.vout[0].nValue = 43;
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 0, 0, 0.0, 1));
+    TestHeaderAndShortIDs shortIDsOther(block);
+    CBlockHeaderAndShortTxIDs cmpctblock = shortIDsOther.ToCompactBlock();
+    shortIDsOther.shorttxids[2] = cmpctblock.GetShortID(txOther.GetHash());
+    PartiallyDownloadedBlock partialBlockOther(&pool);
+    BOOST_CHECK(partialBlockOther.InitData(shortIDsOther.ToCompactBlock()) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlockOther.IsTxAvailable(3));
+
+    CBlock blockRebuilt;
+    std::vector<CTransaction> vtxMissing;
+    vtxMissing.push_back(block.vtx[1]);
+    vtxMissing.push_back(block.vtx[2]);
+    BOOST_CHECK(partialBlockOther.FillBlock(blockRebuilt, vtxMissing) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidPrefilledTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // An index past the end of the block
+    TestHeaderAndShortIDs shortIDs(block);
+    shortIDs.prefilledtxn[0].index = 4;
+    shortIDs.shorttxids.pop_back();
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs.ToCompactBlock()) == READ_STATUS_INVALID);
+
+    // Indexes that don't increase
+    TestHeaderAndShortIDs shortIDsRepeated(block);
+    shortIDsRepeated.prefilledtxn.push_back(shortIDsRepeated.prefilledtxn[0]);
+    shortIDsRepeated.shorttxids.pop_back();
+    PartiallyDownloadedBlock partialBlockRepeated(&pool);
+    BOOST_CHECK(partialBlockRepeated.InitData(shortIDsRepeated.ToCompactBlock()) == READ_STATUS_INVALID);
+
+    // A null transaction
+    TestHeaderAndShortIDs shortIDsNull(block);
+    shortIDsNull.prefilledtxn[0].tx = CTransaction();
+    PartiallyDownloadedBlock partialBlockNull(&pool);
+    BOOST_CHECK(partialBlockNull.InitData(shortIDsNull.ToCompactBlock()) == READ_STATUS_INVALID);
+
+    // Nothing at all
+    TestHeaderAndShortIDs shortIDsEmpty(block);
+    shortIDsEmpty.prefilledtxn.clear();
+    shortIDsEmpty.shorttxids.clear();
+    PartiallyDownloadedBlock partialBlockEmpty(&pool);
+    BOOST_CHECK(partialBlockEmpty.InitData(shortIDsEmpty.ToCompactBlock()) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
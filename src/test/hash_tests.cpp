@@ -46,4 +46,13 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Reference SipHash-2-4 output for the key 000102..0f and message 000102..1f
+    // (the uint256 string is big-endian, so its bytes are 00 01 02 .. 1f in memory).
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                          uint256("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")),
+        0x7127512f72f27cceULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -317,6 +317,52 @@ Test_EqualityPoK()
 	return true;
 }
 
+bool
+Test_FixedBaseExp()
+{
+	try {
+		const IntegerGroupParams* groups[] = {&g_Params->coinCommitmentGroup,
+		                                      &g_Params->serialNumberSoKCommitmentGroup,
+		                                      &g_Params->accumulatorParams.accumulatorPoKCommitmentGroup};
+
+		for (const IntegerGroupParams* group : groups) {
+			if (!group->gTable || !group->hTable) {
+				return false;
+			}
+
+			// Random, negative, zero and oversized exponents must all
+			// match the generic exponentiation
+			uint32_t nMaxBits = group->gTable->getMaxExponentBits();
+			vector<CBigNum> exponents;
+			exponents.push_back(CBigNum(0));
+			exponents.push_back(CBigNum(1));
+			exponents.push_back(CBigNum::randBignum(group->groupOrder));
+			exponents.push_back(CBigNum(0) - CBigNum::randBignum(group->modulus));
+			exponents.push_back(CBigNum::RandKBitBigum(nMaxBits));
+			exponents.push_back(CBigNum::RandKBitBigum(nMaxBits + 10));
+
+			for (const CBigNum& e : exponents) {
+				if (group->gPow(e, group->modulus) != group->g.pow_mod(e, group->modulus) ||
+				    group->hPow(e, group->modulus) != group->h.pow_mod(e, group->modulus)) {
+					return false;
+				}
+			}
+		}
+
+		const AccumulatorAndProofParams& acc = g_Params->accumulatorParams;
+		CBigNum e = CBigNum(0) - CBigNum::randBignum(acc.accumulatorModulus);
+		if (acc.accumulatorQRNCommitmentGroup.hPow(e, acc.accumulatorModulus) !=
+		    acc.accumulatorQRNCommitmentGroup.h.inverse(acc.accumulatorModulus).pow_mod(CBigNum(0) - e, acc.accumulatorModulus)) {
+			return false;
+		}
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
 bool
 Test_MintCoin()
 {
@@ -461,6 +507,7 @@ Test_RunAllTests()
 	LogTestResult("parameter sizes are correct", Test_CalcParamSizes);
 	LogTestResult("group/field parameters can be generated", Test_GenerateGroupParams);
 	LogTestResult("parameter generation is correct", Test_ParamGen);
+	LogTestResult("fixed-base exponentiation matches pow_mod", Test_FixedBaseExp);
 	LogTestResult("coins can be minted", Test_MintCoin);
 	LogTestResult("invalid coins will be rejected", Test_InvalidCoin);
 	LogTestResult("the accumulator works", Test_Accumulator);
@@ -0,0 +1,50 @@
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lrucache.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(lrucache_tests)
+
+BOOST_AUTO_TEST_CASE(lrucache_evicts_least_recently_used)
+{
+    lrucache<int, int> cache(3);
+    for (int i = 0; i < 3; i++)
+        cache.insert(i, i * 10);
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+    // touching 0 makes 1 the least recently used entry
+    int v = 0;
+    BOOST_CHECK(cache.get(0, v));
+    BOOST_CHECK_EQUAL(v, 0);
+
+    cache.insert(3, 30);
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(!cache.count(1));
+    BOOST_CHECK(cache.count(0));
+    BOOST_CHECK(cache.count(2));
+    BOOST_CHECK(cache.get(3, v));
+    BOOST_CHECK_EQUAL(v, 30);
+
+    // overwriting an entry refreshes it instead of growing the cache
+    cache.insert(2, 21);
+    cache.insert(4, 40);
+    BOOST_CHECK(!cache.count(0));
+    BOOST_CHECK(cache.get(2, v));
+    BOOST_CHECK_EQUAL(v, 21);
+
+    cache.erase(2);
+    BOOST_CHECK(!cache.get(2, v));
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+    cache.max_size(1);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(cache.count(4));
+
+    cache.clear();
+    BOOST_CHECK(cache.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "util.h"
 
 #include <boost/test/unit_test.hpp>
+#include <limits>
 #include <list>
 
 BOOST_AUTO_TEST_SUITE(mempool_tests)
@@ -99,4 +100,271 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolScoreIndexTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // Three same-sized transactions paying different fees
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000, 0, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 3000, 0, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 2000, 0, 0.0, 1));
+
+    std::vector<uint256> vOrder;
+    BOOST_FOREACH (const CTxMemPool::txiter& it, pool.setTxByScore)
+        vOrder.push_back(it->first);
+    BOOST_CHECK(vOrder.size() == 3);
+    BOOST_CHECK(vOrder[0] == tx[1].GetHash());
+    BOOST_CHECK(vOrder[1] == tx[2].GetHash());
+    BOOST_CHECK(vOrder[2] == tx[0].GetHash());
+
+    // Prioritisation moves an entry already in the pool
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0.0, 5000);
+    BOOST_CHECK((*pool.setTxByScore.begin())->first == tx[0].GetHash());
+
+    // Removal takes the entry out of the index
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(pool.setTxByScore.size(), 2);
+    BOOST_CHECK((*pool.setTxByScore.begin())->first == tx[1].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain of three: tx[0] <- tx[1] <- tx[2]
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = i == 0 ? GetRandHash() : tx[i - 1].GetHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    CAmount nFees[3] = {1000, 2000, 4000};
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], 0, 0.0, 1));
+
+    CTxMemPool::txiter it[3];
+    for (int i = 0; i < 3; i++)
+        it[i] = pool.mapTx.find(tx[i].GetHash());
+    uint64_t nSize = it[0]->second.GetTxSize();
+
+    BOOST_CHECK(pool.GetMemPoolParents(it[0]).empty());
+    BOOST_CHECK(pool.GetMemPoolChildren(it[0]).count(it[1]));
+    BOOST_CHECK(pool.GetMemPoolParents(it[2]).count(it[1]));
+    BOOST_CHECK(pool.GetMemPoolChildren(it[2]).empty());
+
+    BOOST_CHECK_EQUAL(it[0]->second.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(it[0]->second.GetSizeWithDescendants(), 3 * nSize);
+    BOOST_CHECK_EQUAL(it[0]->second.GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(it[2]->second.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it[2]->second.GetModFeesWithAncestors(), 7000);
+    BOOST_CHECK_EQUAL(it[1]->second.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it[1]->second.GetCountWithDescendants(), 2);
+
+    // Prioritisation shows up in the totals on both sides
+    pool.PrioritiseTransaction(tx[1].GetHash(), tx[1].GetHash().ToString(), 0.0, 500);
+    BOOST_CHECK_EQUAL(it[0]->second.GetModFeesWithDescendants(), 7500);
+    BOOST_CHECK_EQUAL(it[2]->second.GetModFeesWithAncestors(), 7500);
+
+    // The ancestor limits are enforced for a new descendant
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = tx[2].GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 10 * COIN;
+    CTxMemPoolEntry entryChild(txChild, 0, 0, 0.0, 1);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryChild, setAncestors, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryChild, setAncestors, 3, nNoLimit, nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryChild, setAncestors, nNoLimit, nNoLimit, 3, nNoLimit, errString));
+
+    // Mining the head of the chain leaves the rest with smaller ancestor totals
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(pool.GetMemPoolParents(it[1]).empty());
+    BOOST_CHECK_EQUAL(it[1]->second.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it[2]->second.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it[2]->second.GetModFeesWithAncestors(), 6500);
+
+    // Dropping the tail leaves the rest with smaller descendant totals
+    removed.clear();
+    pool.remove(tx[2], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(pool.GetMemPoolChildren(it[1]).empty());
+    BOOST_CHECK_EQUAL(it[1]->second.GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(it[1]->second.GetSizeWithDescendants(), nSize);
+    BOOST_CHECK_EQUAL(it[1]->second.GetModFeesWithDescendants(), 2500);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolReorgRelinkTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain of three: tx[0] <- tx[1] <- tx[2]
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = i == 0 ? GetRandHash() : tx[i - 1].GetHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    CAmount nFees[3] = {1000, 2000, 4000};
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], 0, 0.0, 1));
+
+    // tx[0] and tx[1] are mined, tx[2] stays behind
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx[0]);
+    vtx.push_back(tx[1]);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx[2].GetHash());
+    uint64_t nSize = it2->second.GetTxSize();
+    BOOST_CHECK_EQUAL(it2->second.GetCountWithAncestors(), 1);
+
+    // The block is disconnected and its transactions come back in block order
+    std::vector<uint256> vHashUpdate;
+    for (int i = 0; i < 2; i++) {
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], 0, 0.0, 1));
+        vHashUpdate.push_back(tx[i].GetHash());
+    }
+    CTxMemPool::txiter it0 = pool.mapTx.find(tx[0].GetHash());
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx[1].GetHash());
+    BOOST_CHECK(pool.GetMemPoolChildren(it1).empty());
+    BOOST_CHECK_EQUAL(it0->second.GetCountWithDescendants(), 2);
+
+    pool.UpdateTransactionsFromBlock(vHashUpdate);
+    BOOST_CHECK(pool.GetMemPoolChildren(it1).count(it2));
+    BOOST_CHECK(pool.GetMemPoolParents(it2).count(it1));
+    BOOST_CHECK_EQUAL(it0->second.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(it0->second.GetSizeWithDescendants(), 3 * nSize);
+    BOOST_CHECK_EQUAL(it0->second.GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(it1->second.GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it1->second.GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(it2->second.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it2->second.GetSizeWithAncestors(), 3 * nSize);
+    BOOST_CHECK_EQUAL(it2->second.GetModFeesWithAncestors(), 7000);
+
+    // The spender now leaves together with the resurrected parent
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 3);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Three unrelated transactions and a high fee child of the cheapest one
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = i == 3 ? tx[2].GetHash() : GetRandHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    CAmount nFees[4] = {3000, 2000, 1000, 9000};
+    int64_t nTimes[4] = {100, 200, 200, 200};
+    for (int i = 0; i < 4; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], nTimes[i], 0.0, 1));
+    size_t nTxSize = pool.mapTx.find(tx[1].GetHash())->second.GetTxSize();
+
+    // Nothing to do while the pool fits
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // tx[2] is carried by its child, so tx[1] has the lowest score
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+    CAmount nRollingFee = CFeeRate(nFees[1], nTxSize).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nRollingFee);
+
+    // Expiry takes the old transaction only
+    BOOST_CHECK_EQUAL(pool.Expire(150), 1);
+    BOOST_CHECK(!pool.exists(tx[0].GetHash()));
+
+    // A package leaves as a whole
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    // The rolling minimum fee halves every half-life once a block has been seen
+    CAmount nMinFee = pool.GetMinFee(1).GetFeePerK();
+    BOOST_CHECK(nMinFee > nRollingFee);
+    int64_t nNow = GetTime();
+    SetMockTime(nNow);
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(nNow + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee / 2);
+    // ... until it drops below half the relay fee and is gone
+    SetMockTime(nNow + 20 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolZerocoinSpendEvictionTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // A fee paying transaction and a zerocoin spend, which pays none
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txSpend(tx);
+    txSpend.vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND << OP_11;
+    txSpend.vin[0].prevout.SetNull();
+    BOOST_CHECK(CTransaction(txSpend).IsZerocoinSpend());
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 0, 0.0, 1));
+
+    // The spend outlasts the transaction that pays a fee
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(txSpend.GetHash()));
+
+    // and is not evicted at all
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,9 @@
 
 #include "wallet.h"
 
+#include "random.h"
+#include "txmempool.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -305,4 +308,171 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+//! Append a block holding only the transaction hashed as hashMerkleRoot to chainActive
+static CBlockIndex* AddFakeBlock(const uint256& hashMerkleRoot, std::vector<CBlockIndex*>& vFakeBlocks)
+{
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = chainActive.Tip();
+    pindex->nHeight = pindex->pprev->nHeight + 1;
+    pindex->nTime = pindex->pprev->nTime + 60;
+    pindex->hashMerkleRoot = hashMerkleRoot;
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(GetRandHash(), pindex)).first;
+    pindex->phashBlock = &mi->first;
+    chainActive.SetTip(pindex);
+    vFakeBlocks.push_back(pindex);
+    return pindex;
+}
+
+//! Confirm wtx in a new block; an empty merkle branch connects it as the only transaction
+static void ConfirmTx(CWallet& w, CWalletTx& wtx, std::vector<CBlockIndex*>& vFakeBlocks)
+{
+    std::list<CTransaction> removed;
+    mempool.remove(wtx, removed);
+    wtx.hashBlock = AddFakeBlock(wtx.GetHash(), vFakeBlocks)->GetBlockHash();
+    wtx.nIndex = 0;
+    w.AddToWallet(wtx);
+}
+
+static CWalletTx AddUnconfirmedTx(CWallet& w, const CMutableTransaction& tx)
+{
+    CWalletTx wtx(&w, tx);
+    mempool.addUnchecked(wtx.GetHash(), CTxMemPoolEntry(wtx, 0, 0, 0.0, chainActive.Height()));
+    w.AddToWallet(wtx);
+    return wtx;
+}
+
+//! Compare the balances and AvailableCoins against the full mapWallet walk they replaced
+static void CheckBalancesMatchWalk(const CWallet& w)
+{
+    LOCK2(cs_main, w.cs_wallet);
+
+    CAmount nBalance = 0, nUnconfirmed = 0, nImmature = 0, nLocked = 0;
+    set<COutPoint> setWalk;
+    BOOST_FOREACH (const PAIRTYPE(const uint256, CWalletTx)& item, w.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (wtx.IsTrusted())
+            nBalance += wtx.GetAvailableCredit(false);
+        if (!IsFinalTx(wtx) || (!wtx.IsTrusted() && wtx.GetDepthInMainChain() == 0))
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+        nImmature += wtx.GetImmatureCredit(false);
+        if (wtx.IsTrusted() && wtx.GetDepthInMainChain() > 0)
+            nLocked += wtx.GetLockedCredit();
+
+        if (!CheckFinalTx(wtx) || !wtx.IsTrusted())
+            continue;
+        if ((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0)
+            continue;
+        if (wtx.GetDepthInMainChain(false) == 0 && !wtx.InMempool())
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            if (w.IsMine(wtx.vout[i]) == ISMINE_NO || w.IsSpent(item.first, i) || w.IsLockedCoin(item.first, i) || wtx.vout[i].nValue <= 0)
+                continue;
+            setWalk.insert(COutPoint(item.first, i));
+        }
+    }
+
+    BOOST_CHECK_EQUAL(w.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(w.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(w.GetImmatureBalance(), nImmature);
+    BOOST_CHECK_EQUAL(w.GetLockedCoins(), nLocked);
+
+    vector<COutput> vAvailable;
+    w.AvailableCoins(vAvailable);
+    set<COutPoint> setAvailable;
+    BOOST_FOREACH (const COutput& out, vAvailable)
+        setAvailable.insert(COutPoint(out.tx->GetHash(), out.i));
+    BOOST_CHECK(setAvailable == setWalk);
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_balances)
+{
+    CWallet walletIndex("wallet_balances.dat");
+    bool fFirstRun;
+    walletIndex.LoadWallet(fFirstRun);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(walletIndex.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript scriptOther = CScript() << OP_11 << OP_EQUAL;
+
+    LOCK2(cs_main, walletIndex.cs_wallet);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    std::vector<CBlockIndex*> vFakeBlocks;
+
+    // A payment waiting in the mempool, then confirmed
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0] = CTxOut(10 * COIN, scriptMine);
+    CWalletTx wtxA = AddUnconfirmedTx(walletIndex, tx);
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetUnconfirmedBalance(), 10 * COIN);
+    ConfirmTx(walletIndex, wtxA, vFakeBlocks);
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetBalance(), 10 * COIN);
+
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout[0] = CTxOut(5 * COIN, scriptMine);
+    CWalletTx wtxB(&walletIndex, tx);
+    ConfirmTx(walletIndex, wtxB, vFakeBlocks);
+    CheckBalancesMatchWalk(walletIndex);
+
+    // Spend wtxA with change back to us, unconfirmed and then confirmed
+    tx.vin[0].prevout = COutPoint(wtxA.GetHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0] = CTxOut(3 * COIN, scriptMine);
+    tx.vout[1] = CTxOut(7 * COIN, scriptOther);
+    CWalletTx wtxSpend = AddUnconfirmedTx(walletIndex, tx);
+    CheckBalancesMatchWalk(walletIndex);
+    ConfirmTx(walletIndex, wtxSpend, vFakeBlocks);
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetBalance(), 8 * COIN);
+
+    // Disconnecting the spend returns it to the mempool, as DisconnectTip does
+    chainActive.SetTip(chainActive.Tip()->pprev);
+    mempool.addUnchecked(wtxSpend.GetHash(), CTxMemPoolEntry(wtxSpend, 0, 0, 0.0, chainActive.Height()));
+    walletIndex.SyncTransaction(wtxSpend, NULL);
+    CheckBalancesMatchWalk(walletIndex);
+    ConfirmTx(walletIndex, wtxSpend, vFakeBlocks);
+    CheckBalancesMatchWalk(walletIndex);
+
+    // A coinstake spending wtxB is immature until it is COINBASE_MATURITY blocks deep
+    tx.vin[0].prevout = COutPoint(wtxB.GetHash(), 0);
+    tx.vout[0].SetEmpty();
+    tx.vout[1] = CTxOut(6 * COIN, scriptMine);
+    CWalletTx wtxStake(&walletIndex, tx);
+    BOOST_CHECK(wtxStake.IsCoinStake());
+    walletIndex.AddToWallet(wtxStake);
+    ConfirmTx(walletIndex, wtxStake, vFakeBlocks);
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetImmatureBalance(), 6 * COIN);
+    while (wtxStake.GetBlocksToMaturity() > 0) {
+        AddFakeBlock(GetRandHash(), vFakeBlocks);
+        CheckBalancesMatchWalk(walletIndex);
+    }
+    BOOST_CHECK_EQUAL(walletIndex.GetImmatureBalance(), 0);
+    BOOST_CHECK_EQUAL(walletIndex.GetBalance(), 9 * COIN);
+
+    // Locked coins leave the balance and AvailableCoins
+    COutPoint outpointChange(wtxSpend.GetHash(), 0);
+    walletIndex.LockCoin(outpointChange);
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetLockedCoins(), 3 * COIN);
+    walletIndex.UnlockCoin(outpointChange);
+    CheckBalancesMatchWalk(walletIndex);
+
+    // Erasing the spend gives wtxA back
+    walletIndex.EraseFromWallet(wtxSpend.GetHash());
+    CheckBalancesMatchWalk(walletIndex);
+    BOOST_CHECK_EQUAL(walletIndex.GetBalance(), 16 * COIN);
+
+    mempool.clear();
+    chainActive.SetTip(pindexTip);
+    BOOST_FOREACH (CBlockIndex* pindex, vFakeBlocks) {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -218,6 +218,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     // Load mapBlockIndex
     uint256 nPreviousCheckpoint;
+    vector<pair<int, CBlockIndex*> > vMissingMintCount;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -251,6 +252,9 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
                 pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
                 pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
+                pindexNew->mapZerocoinMintCount = diskindex.mapZerocoinMintCount;
+                if (!(pindexNew->nStatus & BLOCK_HAVE_MINT_COUNT))
+                    vMissingMintCount.push_back(make_pair(pindexNew->nHeight, pindexNew));
 
                 //Proof Of Stake
                 pindexNew->nMint = diskindex.nMint;
@@ -287,6 +291,21 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
+    // Backfill the cumulative zerocoin mint counts of entries written before they were recorded,
+    // in height order so every previous block already has its counts
+    if (!vMissingMintCount.empty()) {
+        LogPrintf("%s : computing zerocoin mint counts for %u blocks\n", __func__, (unsigned int)vMissingMintCount.size());
+        sort(vMissingMintCount.begin(), vMissingMintCount.end());
+        CLevelDBBatch batch;
+        for (const pair<int, CBlockIndex*>& item : vMissingMintCount) {
+            CBlockIndex* pindex = item.second;
+            pindex->SetZerocoinMintCount();
+            batch.Write(make_pair('b', pindex->GetBlockHash()), CDiskBlockIndex(pindex));
+        }
+        if (!WriteBatch(batch))
+            return error("%s : failed to write zerocoin mint counts", __func__);
+    }
+
     return true;
 }
 
@@ -424,3 +443,26 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(make_pair('2', nChecksum));
 }
+
+bool CZerocoinDB::WriteBlockPubcoinsBatch(int nHeight, const std::map<libzerocoin::CoinDenomination, CBlockPubcoins>& mapPubcoins)
+{
+    CLevelDBBatch batch;
+    for (std::map<libzerocoin::CoinDenomination, CBlockPubcoins>::const_iterator it = mapPubcoins.begin(); it != mapPubcoins.end(); it++)
+        batch.Write(make_pair('p', make_pair(nHeight, (int)it->first)), it->second);
+
+    LogPrint("zero", "%s : height:%d denominations:%u\n", __func__, nHeight, (unsigned int)mapPubcoins.size());
+    return WriteBatch(batch);
+}
+
+bool CZerocoinDB::ReadBlockPubcoins(int nHeight, libzerocoin::CoinDenomination denom, CBlockPubcoins& pubcoins)
+{
+    return Read(make_pair('p', make_pair(nHeight, (int)denom)), pubcoins);
+}
+
+bool CZerocoinDB::EraseBlockPubcoins(int nHeight)
+{
+    CLevelDBBatch batch;
+    for (libzerocoin::CoinDenomination denom : libzerocoin::zerocoinDenomList)
+        batch.Erase(make_pair('p', make_pair(nHeight, (int)denom)));
+    return WriteBatch(batch);
+}
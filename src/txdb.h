@@ -69,6 +69,26 @@ public:
     bool LoadBlockIndexGuts();
 };
 
+/** Pubcoins of a single denomination minted in one block, as kept in the zerocoin mint index */
+class CBlockPubcoins
+{
+public:
+    uint256 hashBlock;
+    //! pubcoin value, and whether its mint passes the invalid outpoint filter
+    std::vector<std::pair<CBigNum, bool> > vPubcoins;
+
+    CBlockPubcoins() { hashBlock = 0; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(vPubcoins);
+    }
+};
+
 /** Zerocoin database (zerocoin/) */
 class CZerocoinDB : public CLevelDBWrapper
 {
@@ -94,6 +114,10 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    /** Mint index: the pubcoins of each denomination minted at a given height */
+    bool WriteBlockPubcoinsBatch(int nHeight, const std::map<libzerocoin::CoinDenomination, CBlockPubcoins>& mapPubcoins);
+    bool ReadBlockPubcoins(int nHeight, libzerocoin::CoinDenomination denom, CBlockPubcoins& pubcoins);
+    bool EraseBlockPubcoins(int nHeight);
 };
 
 #endif // BITCOIN_TXDB_H
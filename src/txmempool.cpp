@@ -7,26 +7,42 @@
 #include "txmempool.h"
 
 #include "clientversion.h"
+#include "core_memusage.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <limits>
+#include <math.h>
+
 #include <boost/circular_buffer.hpp>
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nFeeDelta(0), fZerocoinSpend(false),
+                                     nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+                                     nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+    nUsageSize = RecursiveDynamicUsage(tx);
+    fZerocoinSpend = tx.IsZerocoinSpend();
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -43,6 +59,31 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(const CAmount& _nFeeDelta)
+{
+    nModFeesWithDescendants += _nFeeDelta - nFeeDelta;
+    nModFeesWithAncestors += _nFeeDelta - nFeeDelta;
+    nFeeDelta = _nFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -356,7 +397,12 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedInnerUsage(0),
+                                                       lastRollingFeeUpdate(GetTime()),
+                                                       blockSinceLastRollingFeeBump(false),
+                                                       rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -403,33 +449,255 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    LOCK(cs);
+    setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    return addUnchecked(hash, entry, setAncestors);
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, const setEntries& setAncestors)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        std::pair<txiter, bool> ret = mapTx.insert(std::make_pair(hash, entry));
+        if (!ret.second)
+            return true;
+        txiter it = ret.first;
+        mapLinks.insert(std::make_pair(hash, TxLinks()));
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+        if (pos != mapDeltas.end())
+            it->second.UpdateFeeDelta(pos->second.second);
+        setTxByScore.insert(it);
+        setTxByDescendantScore.insert(it);
+        setTxByEntryTime.insert(it);
+        cachedInnerUsage += it->second.DynamicMemoryUsage();
+        const CTransaction& tx = it->second.GetTx();
         if(!tx.IsZerocoinSpend()) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+                txiter itParent = mapTx.find(tx.vin[i].prevout.hash);
+                if (itParent != mapTx.end())
+                    UpdateParent(it, itParent, true);
+            }
         }
+        UpdateAncestorsOf(true, it, setAncestors);
+        UpdateEntryForAncestors(it, setAncestors);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
     }
     return true;
 }
 
+void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
+{
+    setEntries& parents = mapLinks[entry->first].parents;
+    if (add && parents.insert(parent).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(parents);
+    else if (!add && parents.erase(parent))
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(parents);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    setEntries& children = mapLinks[entry->first].children;
+    if (add && children.insert(child).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(children);
+    else if (!add && children.erase(child))
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(children);
+}
+
+void CTxMemPool::UpdateDescendantStateOf(txiter it, int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    // The descendant totals are part of the eviction sort key
+    setTxByDescendantScore.erase(it);
+    it->second.UpdateDescendantState(modifySize, modifyFee, modifyCount);
+    setTxByDescendantScore.insert(it);
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    std::map<uint256, TxLinks>::const_iterator it = mapLinks.find(entry->first);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    std::map<uint256, TxLinks>::const_iterator it = mapLinks.find(entry->first);
+    assert(it != mapLinks.end());
+    return it->second.children;
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents)
+{
+    LOCK(cs);
+    setEntries parentHashes;
+    const CTransaction& tx = entry.GetTx();
+
+    if (!fSearchForParents) {
+        parentHashes = GetMemPoolParents(mapTx.find(tx.GetHash()));
+    } else if (!tx.IsZerocoinSpend()) {
+        // Zerocoin spends have no prevouts, only regular inputs can have parents in the pool
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            txiter itParent = mapTx.find(tx.vin[i].prevout.hash);
+            if (itParent == mapTx.end())
+                continue;
+            parentHashes.insert(itParent);
+            if (parentHashes.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+
+    uint64_t totalSizeWithAncestors = entry.GetTxSize();
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+        setAncestors.insert(stageit);
+        parentHashes.erase(parentHashes.begin());
+        totalSizeWithAncestors += stageit->second.GetTxSize();
+
+        if (stageit->second.GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->first.ToString(), limitDescendantSize);
+            return false;
+        } else if (stageit->second.GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->first.ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        const setEntries& setMemPoolParents = GetMemPoolParents(stageit);
+        BOOST_FOREACH (const txiter& itParent, setMemPoolParents) {
+            if (!setAncestors.count(itParent))
+                parentHashes.insert(itParent);
+            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(txiter it, setEntries& setDescendants)
+{
+    setEntries stage;
+    if (!setDescendants.count(it))
+        stage.insert(it);
+    while (!stage.empty()) {
+        txiter stageit = *stage.begin();
+        setDescendants.insert(stageit);
+        stage.erase(stage.begin());
+
+        const setEntries& setChildren = GetMemPoolChildren(stageit);
+        BOOST_FOREACH (const txiter& itChild, setChildren) {
+            if (!setDescendants.count(itChild))
+                stage.insert(itChild);
+        }
+    }
+}
+
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, const setEntries& setAncestors)
+{
+    BOOST_FOREACH (const txiter& itParent, GetMemPoolParents(it))
+        UpdateChild(itParent, it, add);
+
+    const int64_t updateCount = (add ? 1 : -1);
+    const int64_t updateSize = updateCount * it->second.GetTxSize();
+    const CAmount updateFee = updateCount * it->second.GetModifiedFee();
+    BOOST_FOREACH (const txiter& itAncestor, setAncestors)
+        UpdateDescendantStateOf(itAncestor, updateSize, updateFee, updateCount);
+}
+
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries& setAncestors)
+{
+    int64_t updateCount = setAncestors.size();
+    int64_t updateSize = 0;
+    CAmount updateFee = 0;
+    BOOST_FOREACH (const txiter& itAncestor, setAncestors) {
+        updateSize += itAncestor->second.GetTxSize();
+        updateFee += itAncestor->second.GetModifiedFee();
+    }
+    it->second.UpdateAncestorState(updateSize, updateFee, updateCount);
+}
+
+void CTxMemPool::UpdateForRemoveFromMempool(const setEntries& entriesToRemove, bool updateDescendants)
+{
+    if (updateDescendants) {
+        // The descendants that stay lose the removed entries from their ancestor totals
+        BOOST_FOREACH (const txiter& itRemove, entriesToRemove) {
+            setEntries setDescendants;
+            CalculateDescendants(itRemove, setDescendants);
+            setDescendants.erase(itRemove);
+            int64_t modifySize = -((int64_t)itRemove->second.GetTxSize());
+            CAmount modifyFee = -itRemove->second.GetModifiedFee();
+            BOOST_FOREACH (const txiter& itDescendant, setDescendants)
+                itDescendant->second.UpdateAncestorState(modifySize, modifyFee, -1);
+        }
+    }
+
+    // The ancestors lose them from their descendant totals. All links are
+    // still in place at this point, so ancestors can be walked through them.
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_FOREACH (const txiter& itRemove, entriesToRemove) {
+        setEntries setAncestors;
+        std::string dummy;
+        CalculateMemPoolAncestors(itRemove->second, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        UpdateAncestorsOf(false, itRemove, setAncestors);
+    }
+
+    // Only now unlink the children, the loop above needed their parent links
+    BOOST_FOREACH (const txiter& itRemove, entriesToRemove) {
+        BOOST_FOREACH (const txiter& itChild, GetMemPoolChildren(itRemove))
+            UpdateParent(itChild, itRemove, false);
+    }
+}
+
+void CTxMemPool::removeUnchecked(txiter it)
+{
+    const CTransaction& tx = it->second.GetTx();
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        mapNextTx.erase(txin.prevout);
+
+    totalTxSize -= it->second.GetTxSize();
+    cachedInnerUsage -= it->second.DynamicMemoryUsage();
+    const TxLinks& links = mapLinks[it->first];
+    cachedInnerUsage -= memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+    setTxByScore.erase(it);
+    setTxByDescendantScore.erase(it);
+    setTxByEntryTime.erase(it);
+    mapLinks.erase(it->first);
+    mapTx.erase(it);
+    nTransactionsUpdated++;
+}
+
+void CTxMemPool::RemoveStaged(const setEntries& stage, bool updateDescendants)
+{
+    AssertLockHeld(cs);
+    UpdateForRemoveFromMempool(stage, updateDescendants);
+    BOOST_FOREACH (const txiter& it, stage)
+        removeUnchecked(it);
+}
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        setEntries txToRemove;
+        txiter origit = mapTx.find(origTx.GetHash());
+        if (origit != mapTx.end()) {
+            txToRemove.insert(origit);
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
@@ -438,31 +706,23 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                txiter nextit = mapTx.find(it->second.ptx->GetHash());
+                assert(nextit != mapTx.end());
+                txToRemove.insert(nextit);
             }
         }
-        while (!txToRemove.empty()) {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            BOOST_FOREACH (const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
+        setEntries setAllRemoves;
+        if (fRecursive) {
+            BOOST_FOREACH (const txiter& it, txToRemove)
+                CalculateDescendants(it, setAllRemoves);
+        } else {
+            setAllRemoves.swap(txToRemove);
         }
+        BOOST_FOREACH (const txiter& it, setAllRemoves)
+            removed.push_back(it->second.GetTx());
+        // Whatever stays in the pool after a recursive removal has no
+        // descendant in setAllRemoves, so only the plain case needs them fixed
+        RemoveStaged(setAllRemoves, !fRecursive);
     }
 }
 
@@ -526,15 +786,66 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
+void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256>& vHashesToUpdate)
+{
+    LOCK(cs);
+    std::set<uint256> setAlreadyIncluded(vHashesToUpdate.begin(), vHashesToUpdate.end());
+
+    // Walk backwards, so a transaction's spenders from the same block already have their own descendants linked
+    BOOST_REVERSE_FOREACH (const uint256& hash, vHashesToUpdate) {
+        txiter it = mapTx.find(hash);
+        if (it == mapTx.end())
+            continue;
+
+        std::map<COutPoint, CInPoint>::iterator iter = mapNextTx.lower_bound(COutPoint(hash, 0));
+        for (; iter != mapNextTx.end() && iter->first.hash == hash; ++iter) {
+            const uint256& childHash = iter->second.ptx->GetHash();
+            txiter itChild = mapTx.find(childHash);
+            assert(itChild != mapTx.end());
+            // Spenders from the block were linked when they were added
+            if (!setAlreadyIncluded.count(childHash)) {
+                UpdateChild(it, itChild, true);
+                UpdateParent(itChild, it, true);
+            }
+        }
+
+        // Transactions from the block already count each other, only the spenders that stayed in the pool are new
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifyCount = 0;
+        BOOST_FOREACH (const txiter& itDescendant, setDescendants) {
+            if (setAlreadyIncluded.count(itDescendant->first))
+                continue;
+            modifySize += itDescendant->second.GetTxSize();
+            modifyFee += itDescendant->second.GetModifiedFee();
+            modifyCount++;
+            itDescendant->second.UpdateAncestorState(it->second.GetTxSize(), it->second.GetModifiedFee(), 1);
+        }
+        UpdateDescendantStateOf(it, modifySize, modifyFee, modifyCount);
+    }
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    setTxByScore.clear();
+    setTxByDescendantScore.clear();
+    setTxByEntryTime.clear();
+    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -546,6 +857,7 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t innerUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
@@ -555,7 +867,11 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
         unsigned int i = 0;
         checkTotal += it->second.GetTxSize();
         const CTransaction& tx = it->second.GetTx();
+        std::map<uint256, TxLinks>::const_iterator itLinks = mapLinks.find(it->first);
+        assert(itLinks != mapLinks.end());
+        innerUsage += it->second.DynamicMemoryUsage() + memusage::DynamicUsage(itLinks->second.parents) + memusage::DynamicUsage(itLinks->second.children);
         bool fDependsWait = false;
+        std::set<uint256> setParentCheck;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
             std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
@@ -563,6 +879,7 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
                 const CTransaction& tx2 = it2->second.GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
+                setParentCheck.insert(it2->first);
             } else {
                 const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
                 assert(coins && coins->IsAvailable(txin.prevout.n));
@@ -574,6 +891,48 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        // Check the links against the inputs and mapNextTx
+        assert(itLinks->second.parents.size() == setParentCheck.size());
+        BOOST_FOREACH (const txiter& itParent, itLinks->second.parents)
+            assert(setParentCheck.count(itParent->first));
+        std::set<uint256> setChildrenCheck;
+        for (std::map<COutPoint, CInPoint>::const_iterator itNext = mapNextTx.lower_bound(COutPoint(it->first, 0));
+             itNext != mapNextTx.end() && itNext->first.hash == it->first; ++itNext)
+            setChildrenCheck.insert(itNext->second.ptx->GetHash());
+        assert(itLinks->second.children.size() == setChildrenCheck.size());
+        BOOST_FOREACH (const txiter& itChild, itLinks->second.children)
+            assert(setChildrenCheck.count(itChild->first));
+        // Check the package totals against the entries reachable through the links
+        for (int nDirection = 0; nDirection < 2; nDirection++) {
+            bool fAncestors = (nDirection == 0);
+            setEntries setReached;
+            setEntries stage = fAncestors ? itLinks->second.parents : itLinks->second.children;
+            while (!stage.empty()) {
+                txiter stageit = *stage.begin();
+                stage.erase(stage.begin());
+                if (!setReached.insert(stageit).second)
+                    continue;
+                const TxLinks& links = mapLinks.find(stageit->first)->second;
+                const setEntries& next = fAncestors ? links.parents : links.children;
+                stage.insert(next.begin(), next.end());
+            }
+            uint64_t nCountCheck = setReached.size() + 1;
+            uint64_t nSizeCheck = it->second.GetTxSize();
+            CAmount nFeesCheck = it->second.GetModifiedFee();
+            BOOST_FOREACH (const txiter& itReached, setReached) {
+                nSizeCheck += itReached->second.GetTxSize();
+                nFeesCheck += itReached->second.GetModifiedFee();
+            }
+            if (fAncestors) {
+                assert(it->second.GetCountWithAncestors() == nCountCheck);
+                assert(it->second.GetSizeWithAncestors() == nSizeCheck);
+                assert(it->second.GetModFeesWithAncestors() == nFeesCheck);
+            } else {
+                assert(it->second.GetCountWithDescendants() == nCountCheck);
+                assert(it->second.GetSizeWithDescendants() == nSizeCheck);
+                assert(it->second.GetModFeesWithDescendants() == nFeesCheck);
+            }
+        }
         if (fDependsWait)
             waitingOnDependants.push_back(&it->second);
         else {
@@ -610,6 +969,11 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
 
     assert(totalTxSize == checkTotal);
+    assert(setTxByScore.size() == mapTx.size());
+    assert(setTxByDescendantScore.size() == mapTx.size());
+    assert(setTxByEntryTime.size() == mapTx.size());
+    assert(mapLinks.size() == mapTx.size());
+    assert(innerUsage == cachedInnerUsage);
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -631,6 +995,27 @@ void CTxMemPool::getTransactions(std::set<uint256>& setTxid)
         setTxid.insert((*mi).first);
 }
 
+static bool CompareEntryByAncestorCount(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b)
+{
+    return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+}
+
+void CTxMemPool::queryEntries(std::vector<CTxMemPoolEntry>& vEntries) const
+{
+    LOCK(cs);
+    // A transaction always has more ancestors than any of its in-mempool parents
+    std::vector<const CTxMemPoolEntry*> vSorted;
+    vSorted.reserve(mapTx.size());
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vSorted.push_back(&mi->second);
+    std::sort(vSorted.begin(), vSorted.end(), CompareEntryByAncestorCount);
+
+    vEntries.clear();
+    vEntries.reserve(vSorted.size());
+    BOOST_FOREACH (const CTxMemPoolEntry* entry, vSorted)
+        vEntries.push_back(*entry);
+}
+
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
@@ -640,6 +1025,15 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(setTxByScore) +
+           memusage::DynamicUsage(setTxByDescendantScore) + memusage::DynamicUsage(setTxByEntryTime) +
+           memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+           memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -689,6 +1083,28 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            // The fee delta is part of the sort keys, take the entry out while changing it
+            setTxByScore.erase(it);
+            setTxByDescendantScore.erase(it);
+            it->second.UpdateFeeDelta(deltas.second);
+            setTxByScore.insert(it);
+            setTxByDescendantScore.insert(it);
+
+            // ... and of the package totals of everything above and below it
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            setEntries setAncestors;
+            CalculateMemPoolAncestors(it->second, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            BOOST_FOREACH (const txiter& itAncestor, setAncestors)
+                UpdateDescendantStateOf(itAncestor, 0, nFeeDelta, 0);
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH (const txiter& itDescendant, setDescendants)
+                itDescendant->second.UpdateAncestorState(0, nFeeDelta, 0);
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -710,6 +1126,85 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
     mapDeltas.erase(hash);
 }
 
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    setEntries toremove;
+    for (indexed_by_entry_time::const_iterator it = setTxByEntryTime.begin(); it != setTxByEntryTime.end() && (*it)->second.GetTime() < time; ++it)
+        toremove.insert(*it);
+    setEntries stage;
+    BOOST_FOREACH (const txiter& removeit, toremove)
+        CalculateDescendants(removeit, stage);
+    RemoveStaged(stage, false);
+    return stage.size();
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!setTxByDescendantScore.empty() && DynamicMemoryUsage() > sizelimit) {
+        txiter it = *setTxByDescendantScore.begin();
+
+        // Zerocoin spends sort last, once only they are left there is nothing a fee rate could evict
+        if (it->second.IsZerocoinSpend())
+            break;
+
+        // We set the new mempool min fee to the feerate of the removed set, plus the
+        // relay fee (ie some value under which we consider txn to have 0 fee). This
+        // way, we don't allow txn to enter mempool with feerate equal to txn which
+        // were removed with no block in between.
+        CFeeRate removed(it->second.GetModFeesWithDescendants(), it->second.GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        setEntries stage;
+        CalculateDescendants(it, stage);
+        nTxnRemoved += stage.size();
+        RemoveStaged(stage, false);
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) {}
 
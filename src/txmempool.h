@@ -8,6 +8,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -42,9 +43,22 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Fee adjustment from PrioritiseTransaction
+    bool fZerocoinSpend;  //! Zerocoin spends pay no fee, so fee rate eviction leaves them alone
+
+    // Totals over this transaction and all its in-mempool descendants
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    // ... and over this transaction and all its in-mempool ancestors
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -54,9 +68,114 @@ public:
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    void UpdateFeeDelta(const CAmount& _nFeeDelta);
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+    bool IsZerocoinSpend() const { return fZerocoinSpend; }
+
+    //! Adjust the descendant totals when a descendant enters or leaves the pool
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    //! Adjust the ancestor totals when an ancestor enters or leaves the pool
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+/** Orders mempool iterators by txid, so that sets of them do not depend on memory layout */
+class CompareIteratorByHash
+{
+public:
+    template <typename T>
+    bool operator()(const T& a, const T& b) const
+    {
+        return a->first < b->first;
+    }
+};
+
+/**
+ * Mining order of mempool entries: highest modified fee rate first, ties
+ * broken by txid so that the order is total.
+ */
+class CompareTxMemPoolEntryByScore
+{
+public:
+    typedef std::map<uint256, CTxMemPoolEntry>::iterator txiter;
+
+    bool operator()(const txiter& a, const txiter& b) const
+    {
+        double f1 = (double)a->second.GetModifiedFee() * b->second.GetTxSize();
+        double f2 = (double)b->second.GetModifiedFee() * a->second.GetTxSize();
+        if (f1 == f2)
+            return a->first < b->first;
+        return f1 > f2;
+    }
+};
+
+/**
+ * Eviction order of mempool entries: lowest fee rate first, where an entry
+ * with descendants counts at the better of its own fee rate and that of the
+ * package with all its descendants. Ties evict the newest entry first.
+ * Zerocoin spends, which pay no fee, come after every other entry.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    typedef std::map<uint256, CTxMemPoolEntry>::iterator txiter;
+
+    bool operator()(const txiter& a, const txiter& b) const
+    {
+        if (a->second.IsZerocoinSpend() != b->second.IsZerocoinSpend())
+            return b->second.IsZerocoinSpend();
+
+        bool fUseADescendants = UseDescendantScore(a->second);
+        bool fUseBDescendants = UseDescendantScore(b->second);
+
+        double aModFee = fUseADescendants ? a->second.GetModFeesWithDescendants() : a->second.GetModifiedFee();
+        double aSize = fUseADescendants ? a->second.GetSizeWithDescendants() : a->second.GetTxSize();
+        double bModFee = fUseBDescendants ? b->second.GetModFeesWithDescendants() : b->second.GetModifiedFee();
+        double bSize = fUseBDescendants ? b->second.GetSizeWithDescendants() : b->second.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+        if (f1 == f2) {
+            if (a->second.GetTime() == b->second.GetTime())
+                return a->first < b->first;
+            return a->second.GetTime() > b->second.GetTime();
+        }
+        return f1 < f2;
+    }
+
+    // Calculate which score to use for an entry (avoiding division).
+    static bool UseDescendantScore(const CTxMemPoolEntry& a)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Expiry order of mempool entries: oldest first */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    typedef std::map<uint256, CTxMemPoolEntry>::iterator txiter;
+
+    bool operator()(const txiter& a, const txiter& b) const
+    {
+        if (a->second.GetTime() == b->second.GetTime())
+            return a->first < b->first;
+        return a->second.GetTime() < b->second.GetTime();
+    }
 };
 
 class CMinerPolicyEstimator;
@@ -101,10 +220,61 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef std::map<uint256, CTxMemPoolEntry>::iterator txiter;
+    typedef std::set<txiter, CompareTxMemPoolEntryByScore> indexed_by_score;
+    typedef std::set<txiter, CompareTxMemPoolEntryByDescendantScore> indexed_by_descendant_score;
+    typedef std::set<txiter, CompareTxMemPoolEntryByEntryTime> indexed_by_entry_time;
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    //! In-mempool parents and children of every entry of mapTx
+    std::map<uint256, TxLinks> mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+    /** Change the descendant totals of an entry, moving it in the eviction index */
+    void UpdateDescendantStateOf(txiter it, int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    /** Link or unlink an entry with its parents and fix up the descendant totals of its ancestors */
+    void UpdateAncestorsOf(bool add, txiter it, const setEntries& setAncestors);
+    /** Set the ancestor totals of a new entry */
+    void UpdateEntryForAncestors(txiter it, const setEntries& setAncestors);
+    /**
+     * Fix up links and totals of the entries that stay in the pool for the
+     * removal of entriesToRemove. updateDescendants must be set unless every
+     * descendant of a removed entry is removed as well.
+     */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove, bool updateDescendants);
+    /** Drop an entry from mapTx and the indexes, its links must already have been taken care of */
+    void removeUnchecked(txiter entry);
+
+public:
+
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
+    //! Every entry of mapTx in mining order, kept up to date on add, remove and prioritisation
+    indexed_by_score setTxByScore;
+    //! ... in eviction order, also kept up to date when descendants come and go
+    indexed_by_descendant_score setTxByDescendantScore;
+    //! ... and in expiry order
+    indexed_by_entry_time setTxByEntryTime;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
@@ -120,14 +290,31 @@ public:
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
+    /**
+     * addUnchecked must update the state of every in-mempool ancestor of the
+     * new entry. When the caller already has them from
+     * CalculateMemPoolAncestors they can be passed in, otherwise they are
+     * looked up here without any limits.
+     */
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, const setEntries& setAncestors);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
+    /**
+     * The transactions of a disconnected block come back into the pool while
+     * their in-pool spenders are still there, and addUnchecked only links new
+     * entries to their parents. Link those spenders to them and fix up the
+     * package totals on both sides. vHashesToUpdate are the transactions put
+     * back, in block order; links among them are already in place.
+     */
+    void UpdateTransactionsFromBlock(const std::vector<uint256>& vHashesToUpdate);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void getTransactions(std::set<uint256>& setTxid);
+    /** Copies of all entries, every transaction ahead of its in-mempool descendants */
+    void queryEntries(std::vector<CTxMemPoolEntry>& vEntries) const;
     void pruneSpent(const uint256& hash, CCoins& coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -137,6 +324,40 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+    /**
+     * Collect all in-mempool ancestors of entry into setAncestors, failing
+     * with errString set if the package would break any of the limits.
+     * fSearchForParents looks the parents up from the inputs, which is needed
+     * for transactions that are not in the pool yet; otherwise the links of
+     * the entry are used.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true);
+
+    /** Add it and all its in-mempool descendants not yet in setDescendants to setDescendants */
+    void CalculateDescendants(txiter it, setEntries& setDescendants);
+
+    /** Remove a set of entries, see UpdateForRemoveFromMempool for updateDescendants */
+    void RemoveStaged(const setEntries& stage, bool updateDescendants);
+
+    /**
+     * The minimum fee to get into the mempool, which may itself not be enough
+     * for larger-sized transactions. The sizelimit passed in is used to
+     * decay the rolling minimum faster while the pool is far from full.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <= sizelimit,
+     * lowest fee rate packages first.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Expire all transactions (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
+    int Expire(int64_t time);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -156,6 +377,9 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /** Estimate of the memory used by the pool, transactions and indexes included */
+    size_t DynamicMemoryUsage() const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -12,7 +12,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70914;
+static const int PROTOCOL_VERSION = 70916;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -20,6 +20,12 @@ static const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 static const int GETHEADERS_VERSION = 70077;
 
+//! Starting with this version 'getheaders' is answered with 'headers' instead of block inventory
+static const int HEADERS_FIRST_VERSION = 70915;
+
+//! "cmpctblock", "getblocktxn" and "blocktxn" messages start with this version
+static const int COMPACT_BLOCKS_VERSION = 70916;
+
 //! disconnect from peers older than this proto version
 static const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 70912;
 static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 70914;
@@ -449,6 +449,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    setUnspentDirty.insert(outpoint);
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData(range);
@@ -466,6 +467,122 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+/**
+ * Queue the outputs of tx, and the outputs it spends, to be re-examined by
+ * UpdateUnspentIndex. Confirming or disconnecting a spend decides whether
+ * the spent outputs stay in the index, so both sides are needed.
+ */
+void CWallet::MarkUnspentDirty(const CTransaction& tx)
+{
+    const uint256 hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        setUnspentDirty.insert(COutPoint(hash, i));
+
+    if (!tx.IsCoinBase() && !tx.IsZerocoinSpend()) {
+        BOOST_FOREACH (const CTxIn& txin, tx.vin)
+            setUnspentDirty.insert(txin.prevout);
+    }
+    fBalancesCached = false;
+}
+
+void CWallet::UpdateUnspentIndex() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Coinbase and coinstake outputs mature as the chain grows, without any wallet event
+    if (pindexUnspent != chainActive.Tip()) {
+        for (int type = 0; type < UNSPENT_TYPE_COUNT; type++)
+            setUnspentDirty.insert(setUnspent[UNSPENT_IMMATURE][type].begin(), setUnspent[UNSPENT_IMMATURE][type].end());
+        pindexUnspent = chainActive.Tip();
+    }
+    if (setUnspentDirty.empty())
+        return;
+    fBalancesCached = false;
+
+    BOOST_FOREACH (const COutPoint& outpoint, setUnspentDirty) {
+        map<COutPoint, CUnspentEntry>::iterator mi = mapUnspent.find(outpoint);
+        if (mi != mapUnspent.end()) {
+            setUnspent[mi->second.state][mi->second.type].erase(outpoint);
+            mapUnspent.erase(mi);
+        }
+        map<COutPoint, CStakeableOutput>::iterator si = mapStakeable.find(outpoint);
+        if (si != mapStakeable.end()) {
+            setStakeWaiting.erase(make_pair(si->second.nTimeStakeable, outpoint));
+            setStakeReady.erase(outpoint);
+            mapStakeable.erase(si);
+        }
+
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+        if (it == mapWallet.end() || outpoint.n >= it->second.vout.size())
+            continue;
+        const CWalletTx& wtx = it->second;
+        const CTxOut& txout = wtx.vout[outpoint.n];
+
+        CUnspentEntry entry;
+        entry.mine = IsMine(txout);
+        if (entry.mine == ISMINE_NO)
+            continue;
+
+        // Only a confirmed spend drops the output. Unconfirmed spends can still be
+        // conflicted or fall out of the mempool, so readers check IsSpent() as well.
+        bool fSpent = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+        for (TxSpends::const_iterator sit = range.first; sit != range.second && !fSpent; ++sit) {
+            map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(sit->second);
+            fSpent = mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) > 0;
+        }
+        if (fSpent)
+            continue;
+
+        if (wtx.GetDepthInMainChain(false) <= 0)
+            entry.state = UNSPENT_UNCONFIRMED;
+        else if ((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0)
+            entry.state = UNSPENT_IMMATURE;
+        else
+            entry.state = UNSPENT_CONFIRMED;
+        entry.type = txout.nValue == Params().MasternodeCollateralLimit() * COIN ? UNSPENT_COLLATERAL : UNSPENT_REGULAR;
+
+        mapUnspent.insert(make_pair(outpoint, entry));
+        setUnspent[entry.state][entry.type].insert(outpoint);
+
+        // Same outputs SelectStakeCoins used to take from AvailableCoins(STAKABLE_COINS)
+        if (entry.state != UNSPENT_CONFIRMED || (entry.mine != ISMINE_SPENDABLE && entry.mine != ISMINE_MULTISIG) || txout.IsZerocoinMint())
+            continue;
+        BlockMap::const_iterator bi = mapBlockIndex.find(wtx.hashBlock);
+        if (bi == mapBlockIndex.end())
+            continue;
+        CStakeableOutput stakeable;
+        stakeable.pindexFrom = bi->second;
+        //if zerocoinspend, then use the block time
+        stakeable.nTimeStakeable = (wtx.IsZerocoinSpend() ? stakeable.pindexFrom->GetBlockTime() : wtx.GetTxTime()) + nStakeMinAge;
+        stakeable.nHeightStakeable = stakeable.pindexFrom->nHeight + (wtx.IsCoinStake() ? Params().COINBASE_MATURITY() : 10) - 1;
+        mapStakeable.insert(make_pair(outpoint, stakeable));
+        setStakeWaiting.insert(make_pair(stakeable.nTimeStakeable, outpoint));
+    }
+    setUnspentDirty.clear();
+}
+
+void CWallet::UpdateStakeSet() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    UpdateUnspentIndex();
+
+    // Move the outputs that have aged past nStakeMinAge, and are deep enough, to the ready set
+    int64_t nNow = GetAdjustedTime();
+    set<pair<int64_t, COutPoint> >::iterator it = setStakeWaiting.begin();
+    while (it != setStakeWaiting.end() && it->first <= nNow) {
+        if (chainActive.Height() >= mapStakeable.at(it->second).nHeightStakeable) {
+            setStakeReady.insert(it->second);
+            setStakeWaiting.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 bool CWallet::GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash, std::string strOutputIndex)
 {
     // wait for reindex and/or import to finish
@@ -635,8 +752,11 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
+        BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet) {
             item.second.MarkDirty();
+            // What is ours may have changed too, e.g. after importing keys or scripts
+            MarkUnspentDirty(item.second);
+        }
     }
 }
 
@@ -650,6 +770,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        MarkUnspentDirty(wtx);
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -694,6 +815,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        MarkUnspentDirty(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -746,14 +868,84 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    if (!zpivTracker)
+        return;
+
+    // Only the newest tip matters, ThreadZerocoinWitnesses skips the ones it did not get to
+    {
+        boost::unique_lock<boost::mutex> lock(mutexWitnessTip);
+        pindexWitnessTip = pindex;
+    }
+    condWitnessTip.notify_one();
+}
+
+const CBlockIndex* CWallet::WaitForWitnessTip()
+{
+    boost::unique_lock<boost::mutex> lock(mutexWitnessTip);
+    while (!pindexWitnessTip)
+        condWitnessTip.wait(lock);
+
+    const CBlockIndex* pindex = pindexWitnessTip;
+    pindexWitnessTip = NULL;
+    return pindex;
+}
+
+void CWallet::UpdateWitnesses(const CBlockIndex* pindex)
+{
+    if (!zpivTracker)
+        return;
+
+    std::vector<CMintMeta> vNeedWitness;
+    {
+        LOCK(cs_wallet);
+        zpivTracker->PruneWitnesses(vNeedWitness);
+    }
+
+    // Start the witnesses of newly confirmed mints, they are advanced below with the rest
+    for (const CMintMeta& meta : vNeedWitness) {
+        CZerocoinMint mint;
+        {
+            LOCK(cs_wallet);
+            uint256 txid;
+            if (!IsPubcoinInBlockchain(meta.hashPubcoin, txid) || !GetMint(meta.hashSerial, mint))
+                continue;
+        }
+
+        bool isV1Coin = libzerocoin::ExtractVersionFromSerial(mint.GetSerialNumber()) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+        libzerocoin::PublicCoin coin(Params().Zerocoin_Params(isV1Coin), mint.GetValue(), mint.GetDenomination());
+        CMintWitness mintWitness;
+        if (InitAccumulatorWitness(coin, mintWitness))
+            zpivTracker->SetWitness(meta.hashPubcoin, mintWitness);
+    }
+
+    // Keep the witnesses of our mints current, so spending and staking them only has to add the last few blocks
+    zpivTracker->UpdateWitnesses(pindex);
+}
+
+void ThreadZerocoinWitnesses(CWallet* pwallet)
+{
+    RenameThread("escrow-zwitness");
+
+    while (true) {
+        const CBlockIndex* pindex = pwallet->WaitForWitnessTip();
+        pwallet->UpdateWitnesses(pindex);
+    }
+}
+
 void CWallet::EraseFromWallet(const uint256& hash)
 {
     if (!fFileBacked)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            MarkUnspentDirty(it->second);
+            mapWallet.erase(it);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -1425,97 +1617,368 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/**
+ * Everything that can make a transaction ours, copied out of the wallet so the
+ * rescan threads can test blocks without taking any lock: key and script ids
+ * plus watch-only and multisig scripts for the outputs, and the wallet's txids
+ * for the inputs. It may match more than IsMine/IsFromMe but never less, so
+ * AddToWalletIfInvolvingMe still has the final say on every match.
+ */
+class CWalletScanFilter
+{
+public:
+    std::set<uint160> setIds;
+    std::set<CScript> setScripts;
+    std::set<uint256> setTxids;
+
+    bool IsRelevant(const CScript& scriptPubKey) const
+    {
+        if (setScripts.count(scriptPubKey))
+            return true;
+
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        if (!Solver(scriptPubKey, whichType, vSolutions))
+            return false;
+
+        switch (whichType) {
+        case TX_ZEROCOINMINT:
+        case TX_PUBKEY:
+            return setIds.count(Hash160(vSolutions[0])) > 0;
+        case TX_PUBKEYHASH:
+        case TX_SCRIPTHASH:
+            return setIds.count(uint160(vSolutions[0])) > 0;
+        case TX_MULTISIG:
+            for (unsigned int i = 1; i + 1 < vSolutions.size(); i++) {
+                if (setIds.count(Hash160(vSolutions[i])))
+                    return true;
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    bool IsRelevant(const CTransaction& tx) const
+    {
+        if (setTxids.count(tx.GetHash()))
+            return true;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (setTxids.count(txin.prevout.hash))
+                return true;
+        }
+        BOOST_FOREACH (const CTxOut& txout, tx.vout) {
+            if (IsRelevant(txout.scriptPubKey))
+                return true;
+        }
+        return false;
+    }
+};
+
+void CWallet::FillScanFilter(CWalletScanFilter& filter) const
+{
+    AssertLockHeld(cs_wallet);
+
+    std::set<CKeyID> setKeyIds;
+    GetKeys(setKeyIds);
+    filter.setIds.insert(setKeyIds.begin(), setKeyIds.end());
+    {
+        LOCK(cs_KeyStore);
+        for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+            filter.setIds.insert(it->first);
+        filter.setScripts.insert(setWatchOnly.begin(), setWatchOnly.end());
+        filter.setScripts.insert(setMultiSig.begin(), setMultiSig.end());
+    }
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        filter.setTxids.insert(it->first);
+}
+
+namespace {
+
+/** A block read ahead for the wallet rescan */
+struct CRescanBlock {
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fRead;
+    std::vector<bool> vMatch; //!< per transaction, whether it passed the CWalletScanFilter
+    bool fDone;
+
+    CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fRead(false), fDone(false) {}
+};
+
+/**
+ * Wallet rescan read-ahead: a pool of threads reads and deserializes the
+ * blocks and runs their transactions through the CWalletScanFilter, and the
+ * caller takes them back in chain order with Next() to commit the matches.
+ */
+class CRescanPipeline
+{
+private:
+    const std::vector<CBlockIndex*>& vBlocks;
+    const CWalletScanFilter& filter;
+    int nThreads;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::shared_ptr<CRescanBlock> > queue;
+    size_t nNextToRead; //!< index into vBlocks of the first block no thread has taken yet
+    bool fStop;
+    std::unique_ptr<boost::thread_group> threadGroup;
+
+    void ReadThread()
+    {
+        RenameThread("escrow-rescan");
+        while (true) {
+            std::shared_ptr<CRescanBlock> pscan;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextToRead < vBlocks.size() && queue.size() >= RESCAN_READ_AHEAD)
+                    cond.wait(lock);
+                if (fStop || nNextToRead == vBlocks.size())
+                    break;
+                pscan = std::make_shared<CRescanBlock>(vBlocks[nNextToRead++]);
+                queue.push_back(pscan);
+            }
+
+            pscan->fRead = ReadBlockFromDisk(pscan->block, pscan->pindex);
+            pscan->vMatch.resize(pscan->block.vtx.size());
+            for (unsigned int i = 0; i < pscan->block.vtx.size(); i++)
+                pscan->vMatch[i] = filter.IsRelevant(pscan->block.vtx[i]);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pscan->fDone = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CRescanPipeline(const std::vector<CBlockIndex*>& vBlocksIn, const CWalletScanFilter& filterIn, int nThreadsIn) : vBlocks(vBlocksIn), filter(filterIn), nThreads(nThreadsIn),
+                                                                                                                    nNextToRead(0), fStop(false) {}
+
+    ~CRescanPipeline()
+    {
+        Stop();
+    }
+
+    void Start()
+    {
+        threadGroup.reset(new boost::thread_group());
+        for (int i = 0; i < nThreads; i++)
+            threadGroup->create_thread(boost::bind(&CRescanPipeline::ReadThread, this));
+    }
+
+    void Stop()
+    {
+        if (!threadGroup)
+            return;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup->join_all();
+        threadGroup.reset();
+    }
+
+    /** Wait for the next block in chain order to be read and filtered, NULL after the last one */
+    std::shared_ptr<CRescanBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && (queue.empty() ? nNextToRead < vBlocks.size() : !queue.front()->fDone))
+            cond.wait(lock);
+        if (fStop || queue.empty())
+            return std::shared_ptr<CRescanBlock>();
+
+        std::shared_ptr<CRescanBlock> pscan = queue.front();
+        queue.pop_front();
+        cond.notify_all();
+        return pscan;
+    }
+};
+
+bool SpendsAnyOf(const CTransaction& tx, const std::set<uint256>& setTxids)
+{
+    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        if (setTxids.count(txin.prevout.hash))
+            return true;
+    }
+    return false;
+}
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and prefiltered on -rescanthreads worker threads; the
+ * calling thread only takes cs_main and cs_wallet to commit the blocks with
+ * matches, in chain order. Blocks connected while the scan runs are scanned
+ * as well before it returns. The scan stops early after AbortRescan().
+ *
+ * @return the number of transactions added or updated, or -1 if another rescan is already running
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
-    int ret = 0;
-    int64_t nNow = GetTime();
-    bool fCheckZESCO = GetBoolArg("-zapwallettxes", false);
-    if (fCheckZESCO)
-        zpivTracker->Init();
+    if (fScanningWallet.exchange(true)) {
+        LogPrintf("%s : a wallet rescan is already in progress\n", __func__);
+        return -1;
+    }
+    fAbortRescan = false;
+    nScanningStartTime = GetTimeMillis();
+    dScanningProgress = 0;
 
-    CBlockIndex* pindex = pindexStart;
-    {
-        LOCK2(cs_main, cs_wallet);
+    int ret = 0;
+    try {
+        int64_t nNow = GetTime();
+        bool fCheckZESCO = GetBoolArg("-zapwallettxes", false);
+        if (fCheckZESCO)
+            zpivTracker->Init();
+
+        // -rescanthreads=0 means autodetect
+        int nThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+        if (nThreads <= 0)
+            nThreads += boost::thread::hardware_concurrency();
+        nThreads = std::max(nThreads, 1);
+
+        CBlockIndex* pindex = pindexStart;
+        double dProgressStart, dProgressTip;
+        {
+            LOCK(cs_main);
 
-        // no need to read and scan block, if block was created before
-        // our wallet birthday (as adjusted for block time variability)
-        while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().Zerocoin_StartHeight())
-            pindex = chainActive.Next(pindex);
+            // no need to read and scan block, if block was created before
+            // our wallet birthday (as adjusted for block time variability)
+            while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().Zerocoin_StartHeight())
+                pindex = chainActive.Next(pindex);
 
+            dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+            dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        }
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+
         set<uint256> setAddedToWallet;
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+        set<uint256> setFound; // transactions added or updated by this scan, their spends are ours too
+        while (pindex && !fAbortRescan) {
+            // Scan up to the tip as it is now, then go round again for whatever was connected meanwhile
+            std::vector<CBlockIndex*> vBlocks;
+            CWalletScanFilter filter;
+            {
+                LOCK2(cs_main, cs_wallet);
+                if (!chainActive.Contains(pindex))
+                    pindex = chainActive.Next(chainActive.FindFork(pindex));
+                for (CBlockIndex* pindexBlock = pindex; pindexBlock; pindexBlock = chainActive.Next(pindexBlock))
+                    vBlocks.push_back(pindexBlock);
+                if (vBlocks.empty())
+                    break;
+                FillScanFilter(filter);
             }
 
-            //If this is a zapwallettx, need to readd zpiv
-            if (fCheckZESCO && pindex->nHeight >= Params().Zerocoin_StartHeight()) {
-                list<CZerocoinMint> listMints;
-                BlockToZerocoinMintList(block, listMints, true);
-
-                for (auto& m : listMints) {
-                    if (IsMyMint(m.GetValue())) {
-                        LogPrint("zero", "%s: found mint\n", __func__);
-                        pwalletMain->UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
-
-                        // Add the transaction to the wallet
-                        for (auto& tx : block.vtx) {
-                            uint256 txid = tx.GetHash();
-                            if (setAddedToWallet.count(txid) || mapWallet.count(txid))
-                                continue;
-                            if (txid == m.GetTxHash()) {
-                                CWalletTx wtx(pwalletMain, tx);
-                                wtx.nTimeReceived = block.GetBlockTime();
-                                wtx.SetMerkleBranch(block);
-                                pwalletMain->AddToWallet(wtx);
-                                setAddedToWallet.insert(txid);
+            CRescanPipeline pipeline(vBlocks, filter, nThreads);
+            pipeline.Start();
+            while (std::shared_ptr<CRescanBlock> pscan = pipeline.Next()) {
+                if (fAbortRescan || ShutdownRequested())
+                    break;
+                pindex = pscan->pindex;
+                CBlock& block = pscan->block;
+
+                if (dProgressTip - dProgressStart > 0.0) {
+                    dScanningProgress = std::max(0.0, std::min(1.0, (Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart)));
+                    if (pindex->nHeight % 100 == 0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanningProgress * 100))));
+                }
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                }
+
+                bool fCheckMints = fCheckZESCO && pindex->nHeight >= Params().Zerocoin_StartHeight();
+                bool fMatch = fCheckMints;
+                for (unsigned int i = 0; i < block.vtx.size() && !fMatch; i++)
+                    fMatch = pscan->vMatch[i] || SpendsAnyOf(block.vtx[i], setFound);
+                if (!pscan->fRead || !fMatch)
+                    continue;
+
+                LOCK2(cs_main, cs_wallet);
+                // Reorganized away since it was queued: the reorg itself told us about its transactions
+                if (!chainActive.Contains(pindex))
+                    break;
+
+                for (unsigned int i = 0; i < block.vtx.size(); i++) {
+                    const CTransaction& tx = block.vtx[i];
+                    if (!pscan->vMatch[i] && !SpendsAnyOf(tx, setFound))
+                        continue;
+                    if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
+                        setFound.insert(tx.GetHash());
+                        ret++;
+                    }
+                }
+
+                //If this is a zapwallettx, need to readd zpiv
+                if (fCheckMints) {
+                    list<CZerocoinMint> listMints;
+                    BlockToZerocoinMintList(block, listMints, true);
+
+                    for (auto& m : listMints) {
+                        if (IsMyMint(m.GetValue())) {
+                            LogPrint("zero", "%s: found mint\n", __func__);
+                            pwalletMain->UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
+
+                            // Add the transaction to the wallet
+                            for (auto& tx : block.vtx) {
+                                uint256 txid = tx.GetHash();
+                                if (setAddedToWallet.count(txid) || mapWallet.count(txid))
+                                    continue;
+                                if (txid == m.GetTxHash()) {
+                                    CWalletTx wtx(pwalletMain, tx);
+                                    wtx.nTimeReceived = block.GetBlockTime();
+                                    wtx.SetMerkleBranch(block);
+                                    pwalletMain->AddToWallet(wtx);
+                                    setAddedToWallet.insert(txid);
+                                    setFound.insert(txid);
+                                }
                             }
-                        }
 
-                        //Check if the mint was ever spent
-                        int nHeightSpend = 0;
-                        uint256 txidSpend;
-                        CTransaction txSpend;
-                        if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
-                            if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
-                                continue;
-
-                            CWalletTx wtx(pwalletMain, txSpend);
-                            CBlockIndex* pindexSpend = chainActive[nHeightSpend];
-                            CBlock blockSpend;
-                            if (ReadBlockFromDisk(blockSpend, pindexSpend))
-                                wtx.SetMerkleBranch(blockSpend);
-
-                            wtx.nTimeReceived = pindexSpend->nTime;
-                            pwalletMain->AddToWallet(wtx);
-                            setAddedToWallet.emplace(txidSpend);
+                            //Check if the mint was ever spent
+                            int nHeightSpend = 0;
+                            uint256 txidSpend;
+                            CTransaction txSpend;
+                            if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
+                                if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
+                                    continue;
+
+                                CWalletTx wtx(pwalletMain, txSpend);
+                                CBlockIndex* pindexSpend = chainActive[nHeightSpend];
+                                CBlock blockSpend;
+                                if (ReadBlockFromDisk(blockSpend, pindexSpend))
+                                    wtx.SetMerkleBranch(blockSpend);
+
+                                wtx.nTimeReceived = pindexSpend->nTime;
+                                pwalletMain->AddToWallet(wtx);
+                                setAddedToWallet.emplace(txidSpend);
+                                setFound.insert(txidSpend);
+                            }
                         }
                     }
                 }
             }
+            pipeline.Stop();
+            if (ShutdownRequested())
+                fAbortRescan = true;
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
-            }
+            // Carry on after the last block looked at, or from the fork if it was reorganized away
+            LOCK(cs_main);
+            pindex = chainActive.Next(chainActive.FindFork(pindex));
         }
+
+        if (fAbortRescan)
+            LogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex ? pindex->nHeight : chainActive.Height(), (double)dScanningProgress);
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    } catch (...) {
+        fScanningWallet = false;
+        throw;
     }
+    fScanningWallet = false;
     return ret;
 }
 
@@ -1620,20 +2083,92 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::GetBalance() const
+/**
+ * Sum every balance over the unspent output index in one pass. The result is
+ * reused until the tip, the mempool or the wallet changes, so repeated balance
+ * calls between blocks don't touch the wallet at all.
+ */
+const CWalletBalances& CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    UpdateUnspentIndex();
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (fBalancesCached && pindexBalances == chainActive.Tip() && nBalancesMempoolUpdated == nMempoolUpdated)
+        return cachedBalances;
+
+    CWalletBalances balances;
+    const CWalletTx* pcoin = NULL;
+    bool fTrusted = false, fUnconfirmed = false, fConfirmed = false;
+    bool fImmature = false, fImmatureCoinBase = false, fImmatureWatchOnly = false;
+    const CAmount nCollateral = Params().MasternodeCollateralLimit() * COIN;
+    for (map<COutPoint, CUnspentEntry>::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); ++it) {
+        const COutPoint& outpoint = it->first;
+        // The index is ordered by txid, so the per-transaction checks run once per transaction
+        if (pcoin == NULL || pcoin->GetHash() != outpoint.hash) {
+            pcoin = &mapWallet.at(outpoint.hash);
+            int nDepth = pcoin->GetDepthInMainChain();
+            fTrusted = pcoin->IsTrusted();
+            fUnconfirmed = !IsFinalTx(*pcoin) || (!fTrusted && nDepth == 0);
+            fConfirmed = fTrusted && nDepth > 0;
+            bool fMaturing = pcoin->GetBlocksToMaturity() > 0;
+            bool fInMainChain = pcoin->IsInMainChain();
+            fImmatureCoinBase = pcoin->IsCoinBase() && fMaturing;
+            fImmature = (pcoin->IsCoinBase() || pcoin->IsCoinStake()) && fMaturing && fInMainChain;
+            fImmatureWatchOnly = fImmatureCoinBase && fInMainChain;
+        }
+
+        const CAmount nValue = pcoin->vout[outpoint.n].nValue;
+        const bool fSpendable = (it->second.mine & ISMINE_SPENDABLE) != 0;
+        const bool fWatchOnly = (it->second.mine & ISMINE_WATCH_ONLY) != 0;
+
+        if (fImmature && fSpendable)
+            balances.nImmature += nValue;
+        if (fImmatureWatchOnly && fWatchOnly)
+            balances.nWatchOnlyImmature += nValue;
+
+        // Must wait until coinbase is safely deep enough in the chain before valuing it
+        if (fImmatureCoinBase || IsSpent(outpoint.hash, outpoint.n))
+            continue;
+
+        if (fTrusted) {
+            if (fSpendable) balances.nTrusted += nValue;
+            if (fWatchOnly) balances.nWatchOnlyTrusted += nValue;
+        }
+        if (fUnconfirmed) {
+            if (fSpendable) balances.nUnconfirmed += nValue;
+            if (fWatchOnly) balances.nWatchOnlyUnconfirmed += nValue;
+        }
+        if (fConfirmed) {
+            // Masternode collaterals are handled like locked coins
+            bool fLocked = IsLockedCoin(outpoint.hash, outpoint.n);
+            bool fCollateral = fMasterNode && nValue == nCollateral;
+            if (fSpendable) {
+                if (fLocked) balances.nLocked += nValue;
+                if (fCollateral) balances.nLocked += nValue;
+                if (!fLocked && !fCollateral) balances.nUnlocked += nValue;
+            }
+            if (fWatchOnly) {
+                if (fLocked) balances.nWatchOnlyLocked += nValue;
+                if (fCollateral) balances.nWatchOnlyLocked += nValue;
+            }
         }
     }
+    if (!MoneyRange(balances.nTrusted) || !MoneyRange(balances.nUnconfirmed) || !MoneyRange(balances.nImmature) || !MoneyRange(balances.nLocked))
+        throw std::runtime_error("CWallet::GetBalances() : value out of range");
 
-    return nTotal;
+    cachedBalances = balances;
+    fBalancesCached = true;
+    pindexBalances = chainActive.Tip();
+    nBalancesMempoolUpdated = nMempoolUpdated;
+    return cachedBalances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nTrusted;
 }
 
 std::map<libzerocoin::CoinDenomination, int> mapMintMaturity;
@@ -1672,36 +2207,16 @@ CAmount CWallet::GetUnlockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetUnlockedCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nUnlocked;
 }
 
 CAmount CWallet::GetLockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetLockedCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nLocked;
 }
 
 // Get a Map pairing the Denominations with the amount of Zerocoin for each Denomination
@@ -1838,85 +2353,38 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnlyImmature;
 }
 
 CAmount CWallet::GetLockedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetLockedWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnlyLocked;
 }
 
 /**
@@ -1928,77 +2396,97 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
-
-            if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (fUseIX && nDepth < 6)
-                continue;
+        UpdateUnspentIndex();
+
+        // Immature outputs are never available, and IX needs confirmed inputs
+        vector<UnspentState> vStates;
+        vStates.push_back(UNSPENT_CONFIRMED);
+        if (!fUseIX)
+            vStates.push_back(UNSPENT_UNCONFIRMED);
+
+        vector<UnspentType> vTypes;
+        if (nCoinType != ONLY_10000)
+            vTypes.push_back(UNSPENT_REGULAR);
+        if (!(fMasterNode && (nCoinType == ONLY_NOT10000IFMN || nCoinType == ONLY_NONDENOMINATED_NOT10000IFMN)))
+            vTypes.push_back(UNSPENT_COLLATERAL);
+
+        BOOST_FOREACH (UnspentState state, vStates) {
+            BOOST_FOREACH (UnspentType type, vTypes) {
+                const CWalletTx* pcoin = NULL;
+                bool fUsable = false;
+                int nDepth = 0;
+                BOOST_FOREACH (const COutPoint& outpoint, setUnspent[state][type]) {
+                    const uint256& wtxid = outpoint.hash;
+                    const unsigned int i = outpoint.n;
+
+                    if (pcoin == NULL || pcoin->GetHash() != wtxid) {
+                        pcoin = &mapWallet.at(wtxid);
+                        nDepth = pcoin->GetDepthInMainChain(false);
+                        fUsable = false;
+                        if (!CheckFinalTx(*pcoin))
+                            continue;
+                        if (fOnlyConfirmed && !pcoin->IsTrusted())
+                            continue;
+                        if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
+                            continue;
+                        // do not use IX for inputs that have less then 6 blockchain confirmations
+                        if (fUseIX && nDepth < 6)
+                            continue;
+                        // We should not consider coins which aren't at least in our mempool
+                        // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                        if (nDepth == 0 && !pcoin->InMempool())
+                            continue;
+                        fUsable = true;
+                    }
+                    if (!fUsable)
+                        continue;
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
-                continue;
+                    bool found = false;
+                    if (nCoinType == ONLY_DENOMINATED) {
+                        found = IsDenominatedAmount(pcoin->vout[i].nValue);
+                    } else if (nCoinType == ONLY_NOT10000IFMN) {
+                        found = !(fMasterNode && pcoin->vout[i].nValue == Params().MasternodeCollateralLimit() * COIN);
+                    } else if (nCoinType == ONLY_NONDENOMINATED_NOT10000IFMN) {
+                        if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                        found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                        if (found && fMasterNode) found = pcoin->vout[i].nValue != Params().MasternodeCollateralLimit() * COIN; // do not use Hot MN funds
+                    } else if (nCoinType == ONLY_10000) {
+                        found = pcoin->vout[i].nValue == Params().MasternodeCollateralLimit() * COIN;
+                    } else {
+                        found = true;
+                    }
+                    if (!found) continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if (nCoinType == ONLY_NOT10000IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == Params().MasternodeCollateralLimit() * COIN);
-                } else if (nCoinType == ONLY_NONDENOMINATED_NOT10000IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if (found && fMasterNode) found = pcoin->vout[i].nValue != Params().MasternodeCollateralLimit() * COIN; // do not use Hot MN funds
-                } else if (nCoinType == ONLY_10000) {
-                    found = pcoin->vout[i].nValue == Params().MasternodeCollateralLimit() * COIN;
-                } else {
-                    found = true;
-                }
-                if (!found) continue;
+                    if (nCoinType == STAKABLE_COINS) {
+                        if (pcoin->vout[i].IsZerocoinMint())
+                            continue;
+                    }
 
-                if (nCoinType == STAKABLE_COINS) {
-                    if (pcoin->vout[i].IsZerocoinMint())
+                    isminetype mine = mapUnspent.at(outpoint).mine;
+                    if (IsSpent(wtxid, i))
                         continue;
-                }
 
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (IsSpent(wtxid, i))
-                    continue;
-                if (mine == ISMINE_NO)
-                    continue;
-
-                if ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2)
-                    continue;
+                    if ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2)
+                        continue;
 
-                if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
-                    continue;
+                    if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
+                        continue;
 
-                if (IsLockedCoin((*it).first, i) && nCoinType != ONLY_10000)
-                    continue;
-                if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
-                    continue;
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                    continue;
+                    if (IsLockedCoin(wtxid, i) && nCoinType != ONLY_10000)
+                        continue;
+                    if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
+                        continue;
+                    if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+                        continue;
 
-                bool fIsSpendable = false;
-                if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
-                    fIsSpendable = true;
-                if ((mine & ISMINE_MULTISIG) != ISMINE_NO)
-                    fIsSpendable = true;
+                    bool fIsSpendable = false;
+                    if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
+                        fIsSpendable = true;
+                    if ((mine & ISMINE_MULTISIG) != ISMINE_NO)
+                        fIsSpendable = true;
 
-                vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
+                    vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
+                }
             }
         }
     }
@@ -2085,36 +2573,31 @@ bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInp
 {
     LOCK(cs_main);
     //Add ESCO
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
     CAmount nAmountSelected = 0;
     if (GetBoolArg("-pivstake", true)) {
-        for (const COutput &out : vCoins) {
+        LOCK(cs_wallet);
+        UpdateStakeSet();
+
+        for (const COutPoint& outpoint : setStakeReady) {
+            const CStakeableOutput& stakeable = mapStakeable.at(outpoint);
+            const CTxOut& txout = mapWallet.at(outpoint.hash).vout[outpoint.n];
+
             //make sure not to outrun target amount
-            if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+            if (nAmountSelected + txout.nValue > nTargetAmount)
                 continue;
 
-            //if zerocoinspend, then use the block time
-            int64_t nTxTime = out.tx->GetTxTime();
-            if (out.tx->IsZerocoinSpend()) {
-                if (!out.tx->IsInMainChain())
-                    continue;
-                nTxTime = mapBlockIndex.at(out.tx->hashBlock)->GetBlockTime();
-            }
-
-            //check for min age
-            if (GetAdjustedTime() - nTxTime < nStakeMinAge)
+            if (txout.nValue <= 0 || IsSpent(outpoint.hash, outpoint.n) || IsLockedCoin(outpoint.hash, outpoint.n))
                 continue;
 
-            //check that it is matured
-            if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+            //a reorg to a shorter chain can leave it short of the required depth again
+            if (chainActive.Height() < stakeable.nHeightStakeable || !chainActive.Contains(stakeable.pindexFrom))
                 continue;
 
             //add to our stake set
-            nAmountSelected += out.tx->vout[out.i].nValue;
+            nAmountSelected += txout.nValue;
 
             std::unique_ptr<CPivStake> input(new CPivStake());
-            input->SetInput((CTransaction) *out.tx, out.i);
+            input->SetPrevout(outpoint, txout, stakeable.pindexFrom);
             listInputs.emplace_back(std::move(input));
         }
     }
@@ -2968,28 +3451,32 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (GetAdjustedTime() - chainActive.Tip()->GetBlockTime() < 60)
         MilliSleep(10000);
 
+    // Hash the parts of each kernel that do not depend on the time once, then search all inputs together
+    CStakeKernelSearch kernelSearch(nBits);
+    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+        if (!kernelSearch.AddInput(stakeInput.get()))
+            LogPrintf("*** no pindexfrom\n");
+    }
+
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
     bool fKernelFound = false;
-    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+    unsigned int nTimeSearch = GetAdjustedTime();
+    size_t nInputStart = 0;
+    size_t nInputFound = 0;
+    uint256 hashProofOfStake = 0;
+    while (true) {
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested())
             return false;
 
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = stakeInput->GetIndexFrom();
-        if (!pindex || pindex->nHeight < 1) {
-            LogPrintf("*** no pindexfrom\n");
-            continue;
-        }
-
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-        uint256 hashProofOfStake = 0;
-        nTxNewTime = GetAdjustedTime();
+        // a kernel that cannot be used moves the search on to the inputs after it
+        if (!kernelSearch.Search(nInputStart, nTimeSearch, nInputFound, nTxNewTime, hashProofOfStake))
+            break;
+        nInputStart = nInputFound + 1;
+        CStakeInput* stakeInput = kernelSearch.GetInput(nInputFound);
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (Stake(stakeInput.get(), nBits, block.GetBlockTime(), nTxNewTime, hashProofOfStake)) {
+        {
             LOCK(cs_main);
             //Double check that this will pass time requirements
             if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
@@ -3045,7 +3532,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
             //Mark mints as spent
             if (stakeInput->IsZESCO()) {
-                CZPivStake* z = (CZPivStake*)stakeInput.get();
+                CZPivStake* z = (CZPivStake*)stakeInput;
                 if (!z->MarkSpent(this, txNew.GetHash()))
                     return error("%s: failed to mark mint as used\n", __func__);
             }
@@ -3053,8 +3540,6 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             fKernelFound = true;
             break;
         }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
     }
     if (!fKernelFound)
         return false;
@@ -3758,6 +4243,8 @@ bool CWallet::UpdatedTransaction(const uint256& hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()) {
+            // A SwiftX lock changes IsTrusted() without any tip or mempool change the balance cache would notice
+            MarkUnspentDirty(mi->second);
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             return true;
         }
@@ -3768,18 +4255,21 @@ bool CWallet::UpdatedTransaction(const uint256& hashTx)
 void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    fBalancesCached = false;
     setLockedCoins.insert(output);
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    fBalancesCached = false;
     setLockedCoins.erase(output);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    fBalancesCached = false;
     setLockedCoins.clear();
 }
 
@@ -4593,10 +5083,14 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(paramsAccumulator, accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, pindexCheckpoint)) {
+    uint256 hashPubcoin = GetPubCoinHash(pubCoinSelected.getValue());
+    CMintWitness mintWitness;
+    zpivTracker->GetWitness(hashPubcoin, mintWitness);
+    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, pindexCheckpoint, &mintWitness)) {
         receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZESCO_FAILED_ACCUMULATOR_INITIALIZATION);
         return error("%s : %s", __func__, receipt.GetStatusMessage());
     }
+    zpivTracker->SetWitness(hashPubcoin, mintWitness);
 
     // Construct the CoinSpend object. This acts like a signature on the transaction.
     libzerocoin::PrivateCoin privateCoin(paramsCoin, denomination);
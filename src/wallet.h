@@ -28,6 +28,7 @@
 #include "zpivtracker.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -59,6 +60,10 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //! -custombackupthreshold default
 static const int DEFAULT_CUSTOMBACKUPTHRESHOLD = 1;
+//! -rescanthreads default (number of threads reading blocks during a wallet rescan, 0 = auto)
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Blocks the rescan threads may read ahead of the one being committed to the wallet
+static const unsigned int RESCAN_READ_AHEAD = 64;
 
 // Zerocoin denomination which creates exactly one of each denominations:
 // 6666 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
@@ -70,6 +75,7 @@ class COutput;
 class CReserveKey;
 class CScript;
 class CWalletTx;
+class CWalletScanFilter;
 
 /** (client) version numbers for particular wallet features */
 enum WalletFeature {
@@ -90,6 +96,51 @@ enum AvailableCoinsType {
     STAKABLE_COINS = 6                          // UTXO's that are valid for staking
 };
 
+/** Confirmation state buckets of the wallet's unspent output index */
+enum UnspentState {
+    UNSPENT_UNCONFIRMED = 0, // not in the main chain (mempool or conflicted)
+    UNSPENT_IMMATURE = 1,    // coinbase or coinstake that has not matured yet
+    UNSPENT_CONFIRMED = 2,
+    UNSPENT_STATE_COUNT
+};
+
+/** Coin type buckets of the wallet's unspent output index */
+enum UnspentType {
+    UNSPENT_REGULAR = 0,
+    UNSPENT_COLLATERAL = 1, // exactly the masternode collateral amount
+    UNSPENT_TYPE_COUNT
+};
+
+/** An output in the wallet's unspent output index and the bucket it is filed under */
+struct CUnspentEntry {
+    UnspentState state;
+    UnspentType type;
+    isminetype mine;
+};
+
+/** An output in the wallet's stake set and when it becomes old and deep enough to stake */
+struct CStakeableOutput {
+    CBlockIndex* pindexFrom; //!< block the output was confirmed in
+    int64_t nTimeStakeable;  //!< adjusted time from which it satisfies nStakeMinAge
+    int nHeightStakeable;    //!< chain height from which it has the required depth
+};
+
+/** Wallet balances summed over the unspent output index, cached until the chain, mempool or wallet changes */
+struct CWalletBalances {
+    CAmount nTrusted;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nLocked;
+    CAmount nUnlocked;
+    CAmount nWatchOnlyTrusted;
+    CAmount nWatchOnlyUnconfirmed;
+    CAmount nWatchOnlyImmature;
+    CAmount nWatchOnlyLocked;
+
+    CWalletBalances() : nTrusted(0), nUnconfirmed(0), nImmature(0), nLocked(0), nUnlocked(0),
+                        nWatchOnlyTrusted(0), nWatchOnlyUnconfirmed(0), nWatchOnlyImmature(0), nWatchOnlyLocked(0) {}
+};
+
 // Possible states for zESCO send
 enum ZerocoinSpendStatus {
     ZESCO_SPEND_OKAY = 0,                            // No error
@@ -192,6 +243,52 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Index of the outputs we own that no confirmed wallet transaction spends,
+     * bucketed by confirmation state and coin type, so the balance getters and
+     * AvailableCoins only look at candidate outputs instead of all of mapWallet.
+     * Wallet changes only queue the affected outpoints in setUnspentDirty; they
+     * are re-examined under cs_main the next time the index is read.
+     */
+    mutable std::map<COutPoint, CUnspentEntry> mapUnspent;
+    mutable std::set<COutPoint> setUnspent[UNSPENT_STATE_COUNT][UNSPENT_TYPE_COUNT];
+    mutable std::set<COutPoint> setUnspentDirty;
+    //! Tip the index was last brought up to date for; immature outputs are re-examined when it moves
+    mutable const CBlockIndex* pindexUnspent;
+
+    mutable CWalletBalances cachedBalances;
+    mutable bool fBalancesCached;
+    mutable const CBlockIndex* pindexBalances;
+    mutable unsigned int nBalancesMempoolUpdated;
+
+    /**
+     * Stake set: the confirmed outputs of the unspent index that can stake, filed
+     * and dropped by UpdateUnspentIndex alongside the index itself. Outputs wait in
+     * setStakeWaiting, ordered by the time they pass nStakeMinAge, and move to
+     * setStakeReady once they are also deep enough.
+     */
+    mutable std::map<COutPoint, CStakeableOutput> mapStakeable;
+    mutable std::set<std::pair<int64_t, COutPoint> > setStakeWaiting;
+    mutable std::set<COutPoint> setStakeReady;
+
+    void MarkUnspentDirty(const CTransaction& tx);
+    void UpdateUnspentIndex() const;
+    void UpdateStakeSet() const;
+    const CWalletBalances& GetBalances() const;
+
+    //! Rescan state, readable without any lock (see getwalletinfo and abortrescan)
+    std::atomic<bool> fScanningWallet;
+    std::atomic<bool> fAbortRescan;
+    std::atomic<int64_t> nScanningStartTime;
+    std::atomic<double> dScanningProgress;
+
+    //! Newest tip the mint witnesses still have to be advanced to, handed from UpdatedBlockTip to ThreadZerocoinWitnesses
+    boost::mutex mutexWitnessTip;
+    CConditionVariable condWitnessTip;
+    const CBlockIndex* pindexWitnessTip;
+
+    void FillScanFilter(CWalletScanFilter& filter) const;
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount);
@@ -303,6 +400,15 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        fScanningWallet = false;
+        fAbortRescan = false;
+        nScanningStartTime = 0;
+        dScanningProgress = 0;
+        pindexWitnessTip = NULL;
+        pindexUnspent = NULL;
+        fBalancesCached = false;
+        pindexBalances = NULL;
+        nBalancesMempoolUpdated = 0;
 
         // Stake Settings
         nHashDrift = 45;
@@ -466,9 +572,17 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+    const CBlockIndex* WaitForWitnessTip();
+    void UpdateWitnesses(const CBlockIndex* pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() const { return fAbortRescan; }
+    bool IsScanning() const { return fScanningWallet; }
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nScanningStartTime : 0; }
+    double ScanningProgress() const { return fScanningWallet ? (double)dScanningProgress : 0; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     CAmount GetBalance() const;
@@ -677,6 +791,8 @@ public:
     boost::signals2::signal<void (const bool& fSuccess, const std::string& filename)> NotifyWalletBacked;
 };
 
+/** Advance the mint witnesses of a wallet to every new tip, away from the block processing thread */
+void ThreadZerocoinWitnesses(CWallet* pwallet);
 
 /** A key allocated from the key pool. */
 class CReserveKey
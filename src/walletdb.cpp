@@ -1377,6 +1377,60 @@ std::map<uint256, std::vector<pair<uint256, uint32_t> > > CWalletDB::MapMintPool
     return mapPool;
 }
 
+bool CWalletDB::WriteMintWitness(const uint256& hashPubcoin, const CMintWitness& mintWitness)
+{
+    return Write(make_pair(string("zwitness"), hashPubcoin), mintWitness);
+}
+
+bool CWalletDB::EraseMintWitness(const uint256& hashPubcoin)
+{
+    return Erase(make_pair(string("zwitness"), hashPubcoin));
+}
+
+//! map with hashPubcoin as the key, paired with the witness state kept for that mint
+std::map<uint256, CMintWitness> CWalletDB::MapMintWitnesses()
+{
+    std::map<uint256, CMintWitness> mapWitnesses;
+    Dbc* pcursor = GetCursor();
+    if (!pcursor)
+        throw runtime_error(std::string(__func__)+" : cannot create DB cursor");
+    unsigned int fFlags = DB_SET_RANGE;
+    for (;;)
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey << make_pair(string("zwitness"), uint256(0));
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            pcursor->close();
+            throw runtime_error(std::string(__func__)+" : error scanning DB");
+        }
+
+        // Unserialize
+        string strType;
+        ssKey >> strType;
+        if (strType != "zwitness")
+            break;
+
+        uint256 hashPubcoin;
+        ssKey >> hashPubcoin;
+
+        CMintWitness mintWitness;
+        ssValue >> mintWitness;
+
+        mapWitnesses.insert(make_pair(hashPubcoin, mintWitness));
+    }
+
+    pcursor->close();
+    return mapWitnesses;
+}
+
 std::list<CDeterministicMint> CWalletDB::ListDeterministicMints()
 {
     std::list<CDeterministicMint> listMints;
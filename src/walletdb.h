@@ -185,6 +185,9 @@ public:
     bool ReadZESCOCount(uint32_t& nCount);
     std::map<uint256, std::vector<pair<uint256, uint32_t> > > MapMintPool();
     bool WriteMintPoolPair(const uint256& hashMasterSeed, const uint256& hashPubcoin, const uint32_t& nCount);
+    bool WriteMintWitness(const uint256& hashPubcoin, const CMintWitness& mintWitness);
+    bool EraseMintWitness(const uint256& hashPubcoin);
+    std::map<uint256, CMintWitness> MapMintWitnesses();
 
 
 private:
@@ -5,6 +5,7 @@
 
 #include "zpivchain.h"
 #include "invalid.h"
+#include "lrucache.h"
 #include "main.h"
 #include "txdb.h"
 #include "ui_interface.h"
@@ -14,6 +15,12 @@
 // For Script size (BIGNUM/Uint256 size)
 #define BIGNUM_SIZE   4
 
+// Number of (height, denomination) mint index entries kept in memory
+static const unsigned int MAX_PUBCOIN_CACHE_SIZE = 5000;
+
+static CCriticalSection cs_pubcoincache;
+static lrucache<std::pair<int, libzerocoin::CoinDenomination>, CBlockPubcoins> cachePubcoins(MAX_PUBCOIN_CACHE_SIZE);
+
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, vector<CBigNum>& vValues)
 {
     for (const CTransaction tx : block.vtx) {
@@ -81,6 +88,46 @@ bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>&
 }
 
 //return a list of zerocoin mints contained in a specific block
+bool BlockToPubcoinIndex(const CBlock& block, std::map<libzerocoin::CoinDenomination, CBlockPubcoins>& mapPubcoins)
+{
+    uint256 hashBlock = block.GetHash();
+    for (const CTransaction& tx : block.vtx) {
+        if(!tx.IsZerocoinMint())
+            continue;
+
+        // Mirror the filtering done by BlockToPubcoinList(), but record the result instead of skipping the mint
+        bool fValid = true;
+        for (const CTxIn& in : tx.vin) {
+            if (!ValidOutPoint(in.prevout, INT_MAX)) {
+                fValid = false;
+                break;
+            }
+        }
+
+        uint256 txHash = tx.GetHash();
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            //edge case: invalid spend with minted change, every mint from here on is filtered
+            if (fValid && !ValidOutPoint(COutPoint(txHash, i), INT_MAX))
+                fValid = false;
+
+            const CTxOut& txOut = tx.vout[i];
+            if(!txOut.scriptPubKey.IsZerocoinMint())
+                continue;
+
+            CValidationState state;
+            libzerocoin::PublicCoin pubCoin(Params().Zerocoin_Params(false));
+            if(!TxOutToPublicCoin(txOut, pubCoin, state))
+                return false;
+
+            CBlockPubcoins& pubcoins = mapPubcoins[pubCoin.getDenomination()];
+            pubcoins.hashBlock = hashBlock;
+            pubcoins.vPubcoins.emplace_back(std::make_pair(pubCoin.getValue(), fValid));
+        }
+    }
+
+    return true;
+}
+
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid)
 {
     for (const CTransaction& tx : block.vtx) {
@@ -216,6 +263,100 @@ bool GetZerocoinMint(const CBigNum& bnPubcoin, uint256& txHash)
     return zerocoinDB->ReadCoinMint(bnPubcoin, txHash);
 }
 
+static bool IndexBlockPubcoins(const CBlock& block, const CBlockIndex* pindex, std::map<libzerocoin::CoinDenomination, CBlockPubcoins>& mapPubcoins)
+{
+    if (!BlockToPubcoinIndex(block, mapPubcoins))
+        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+    if (mapPubcoins.empty())
+        return true;
+
+    {
+        LOCK(cs_pubcoincache);
+        for (auto& it : mapPubcoins)
+            cachePubcoins.insert(std::make_pair(pindex->nHeight, it.first), it.second);
+    }
+
+    return zerocoinDB->WriteBlockPubcoinsBatch(pindex->nHeight, mapPubcoins);
+}
+
+bool IndexBlockPubcoins(const CBlock& block, const CBlockIndex* pindex)
+{
+    std::map<libzerocoin::CoinDenomination, CBlockPubcoins> mapPubcoins;
+    return IndexBlockPubcoins(block, pindex, mapPubcoins);
+}
+
+bool IndexBlockPubcoinsIfMissing(const CBlockIndex* pindex)
+{
+    for (auto denom : pindex->vMintDenominationsInBlock) {
+        CBlockPubcoins pubcoins;
+        if (zerocoinDB->ReadBlockPubcoins(pindex->nHeight, denom, pubcoins) && pubcoins.hashBlock == pindex->GetBlockHash())
+            continue;
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("%s: failed to read block %d from disk", __func__, pindex->nHeight);
+        return IndexBlockPubcoins(block, pindex);
+    }
+
+    return true;
+}
+
+bool EraseBlockPubcoinIndex(const CBlockIndex* pindex)
+{
+    {
+        LOCK(cs_pubcoincache);
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            cachePubcoins.erase(std::make_pair(pindex->nHeight, denom));
+    }
+
+    return zerocoinDB->EraseBlockPubcoins(pindex->nHeight);
+}
+
+bool GetBlockPubcoins(const CBlockIndex* pindex, libzerocoin::CoinDenomination denom, bool fFilterInvalid, std::vector<CBigNum>& vValues)
+{
+    vValues.clear();
+    if (!pindex->MintedDenomination(denom))
+        return true;
+
+    // Entries are keyed by height, so only trust ones that were recorded for this exact block
+    std::pair<int, libzerocoin::CoinDenomination> key = std::make_pair(pindex->nHeight, denom);
+    uint256 hashBlock = pindex->GetBlockHash();
+    CBlockPubcoins pubcoins;
+    bool fFound = false;
+    {
+        LOCK(cs_pubcoincache);
+        fFound = cachePubcoins.get(key, pubcoins) && pubcoins.hashBlock == hashBlock;
+    }
+
+    if (!fFound && zerocoinDB->ReadBlockPubcoins(pindex->nHeight, denom, pubcoins) && pubcoins.hashBlock == hashBlock) {
+        LOCK(cs_pubcoincache);
+        cachePubcoins.insert(key, pubcoins);
+        fFound = true;
+    }
+
+    // Not indexed yet (e.g. connected by an older version), fall back to the block and index it now
+    if (!fFound) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("%s: failed to read block %d from disk", __func__, pindex->nHeight);
+
+        std::map<libzerocoin::CoinDenomination, CBlockPubcoins> mapPubcoins;
+        if (!IndexBlockPubcoins(block, pindex, mapPubcoins))
+            return error("%s: failed to index mints of block %d", __func__, pindex->nHeight);
+
+        pubcoins = mapPubcoins.count(denom) ? mapPubcoins.at(denom) : CBlockPubcoins();
+    }
+
+    for (const std::pair<CBigNum, bool>& pubcoin : pubcoins.vPubcoins) {
+        if (fFilterInvalid && !pubcoin.second)
+            continue;
+        vValues.emplace_back(pubcoin.first);
+    }
+
+    return true;
+}
+
 bool IsPubcoinInBlockchain(const uint256& hashPubcoin, uint256& txid)
 {
     txid = 0;
@@ -276,6 +417,9 @@ std::string ReindexZerocoinDB()
             return _("Reindexing zerocoin failed");
         }
 
+        if (!pindex->vMintDenominationsInBlock.empty() && !IndexBlockPubcoins(block, pindex))
+            return _("Error writing zerocoinDB to disk");
+
         for (const CTransaction& tx : block.vtx) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 if (tx.IsCoinBase())
@@ -10,9 +10,12 @@
 #include "libzerocoin/Denominations.h"
 #include "libzerocoin/CoinSpend.h"
 #include <list>
+#include <map>
 #include <string>
 
 class CBlock;
+class CBlockIndex;
+class CBlockPubcoins;
 class CBigNum;
 struct CMintMeta;
 class CTransaction;
@@ -23,11 +26,16 @@ class CZerocoinMint;
 class uint256;
 
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vValues);
+bool BlockToPubcoinIndex(const CBlock& block, std::map<libzerocoin::CoinDenomination, CBlockPubcoins>& mapPubcoins);
 bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid);
+bool EraseBlockPubcoinIndex(const CBlockIndex* pindex);
 void FindMints(std::vector<CMintMeta> vMintsToFind, std::vector<CMintMeta>& vMintsToUpdate, std::vector<CMintMeta>& vMissingMints);
+bool GetBlockPubcoins(const CBlockIndex* pindex, libzerocoin::CoinDenomination denom, bool fFilterInvalid, std::vector<CBigNum>& vValues);
 int GetZerocoinStartHeight();
 bool GetZerocoinMint(const CBigNum& bnPubcoin, uint256& txHash);
+bool IndexBlockPubcoins(const CBlock& block, const CBlockIndex* pindex);
+bool IndexBlockPubcoinsIfMissing(const CBlockIndex* pindex);
 bool IsPubcoinInBlockchain(const uint256& hashPubcoin, uint256& txid);
 bool IsSerialKnown(const CBigNum& bnSerial);
 bool IsSerialInBlockchain(const CBigNum& bnSerial, int& nHeightTx);
@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zpivspendcache.h"
+
+#include "hash.h"
+#include "libzerocoin/CoinSpend.h"
+#include "random.h"
+#include "util.h"
+
+#include <boost/thread/locks.hpp>
+
+CZerocoinSpendCache zerocoinSpendCache;
+
+uint256 CZerocoinSpendCache::GetSpendHash(const libzerocoin::CoinSpend& spend)
+{
+    return SerializeHash(spend);
+}
+
+bool CZerocoinSpendCache::Get(const uint256& hashSpend, uint32_t nChecksum)
+{
+    bool fFound;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        fFound = setValid.count(spenddata_type(hashSpend, nChecksum)) > 0;
+    }
+
+    if (fFound)
+        ++nHits;
+    else
+        ++nMisses;
+    return fFound;
+}
+
+void CZerocoinSpendCache::Set(const uint256& hashSpend, uint32_t nChecksum)
+{
+    // Each entry is well under 100 bytes, and a block can carry only a handful
+    // of spends, so the default keeps well over a day of spends in memory.
+    int64_t nMaxCacheSize = GetArg("-maxzcspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+    if (nMaxCacheSize <= 0) return;
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+    while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+        // Evict a random entry, for the same reason the signature cache does:
+        // an attacker cannot predict which verified spends remain cached.
+        uint256 randomHash = GetRandHash();
+        std::set<spenddata_type>::iterator it = setValid.lower_bound(spenddata_type(randomHash, 0));
+        if (it == setValid.end())
+            it = setValid.begin();
+        setValid.erase(it);
+    }
+
+    setValid.insert(spenddata_type(hashSpend, nChecksum));
+}
+
+void CZerocoinSpendCache::Clear()
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+    setValid.clear();
+    nHits = 0;
+    nMisses = 0;
+}
+
+size_t CZerocoinSpendCache::Size()
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+    return setValid.size();
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The Escrow developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef Escrow_ZESCOSPENDCACHE_H
+#define Escrow_ZESCOSPENDCACHE_H
+
+#include "uint256.h"
+
+#include <atomic>
+#include <set>
+#include <stdint.h>
+#include <utility>
+
+#include <boost/thread/shared_mutex.hpp>
+
+namespace libzerocoin
+{
+class CoinSpend;
+}
+
+/** Default for -maxzcspendcachesize, maximum number of verified zerocoin spends kept in memory */
+static const int64_t DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 10000;
+
+/**
+ * Cache of zerocoin spends whose proofs have already been verified, to avoid
+ * running the expensive CoinSpend::Verify() twice for every spend (once when
+ * accepted into the memory pool, and again when accepted into the block chain).
+ *
+ * Entries are keyed by the hash of the serialized CoinSpend together with the
+ * checksum of the accumulator it was verified against.
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! spenddata_type is (serialized spend hash, accumulator checksum)
+    typedef std::pair<uint256, uint32_t> spenddata_type;
+    std::set<spenddata_type> setValid;
+    boost::shared_mutex cs_spendcache;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CZerocoinSpendCache() : nHits(0), nMisses(0) {}
+
+    static uint256 GetSpendHash(const libzerocoin::CoinSpend& spend);
+
+    bool Get(const uint256& hashSpend, uint32_t nChecksum);
+    void Set(const uint256& hashSpend, uint32_t nChecksum);
+    void Clear();
+
+    size_t Size();
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+};
+
+extern CZerocoinSpendCache zerocoinSpendCache;
+
+#endif //Escrow_ZESCOSPENDCACHE_H
@@ -32,7 +32,28 @@ void CzESCOTracker::Init()
 {
     //Load all CZerocoinMints and CDeterministicMints from the database
     if (!fInitialized) {
+        {
+            LOCK(cs_witnesses);
+            mapWitnesses = CWalletDB(strWalletFile).MapMintWitnesses();
+        }
         ListMints(false, false, true);
+
+        //Drop stored witnesses of mints that are no longer in the wallet
+        std::set<uint256> setPubcoins;
+        for (auto& it : mapSerialHashes)
+            setPubcoins.insert(it.second.hashPubcoin);
+        {
+            LOCK(cs_witnesses);
+            std::map<uint256, CMintWitness>::iterator it = mapWitnesses.begin();
+            while (it != mapWitnesses.end()) {
+                if (setPubcoins.count(it->first)) {
+                    ++it;
+                    continue;
+                }
+                CWalletDB(strWalletFile).EraseMintWitness(it->first);
+                mapWitnesses.erase(it++);
+            }
+        }
         fInitialized = true;
     }
 }
@@ -41,6 +62,7 @@ bool CzESCOTracker::Archive(CMintMeta& meta)
 {
     if (mapSerialHashes.count(meta.hashSerial))
         mapSerialHashes.at(meta.hashSerial).isArchived = true;
+    EraseWitness(meta.hashPubcoin);
 
     CWalletDB walletdb(strWalletFile);
     CZerocoinMint mint;
@@ -87,6 +109,109 @@ CMintMeta CzESCOTracker::Get(const uint256 &hashSerial)
     return mapSerialHashes.at(hashSerial);
 }
 
+bool CzESCOTracker::GetWitness(const uint256& hashPubcoin, CMintWitness& mintWitness)
+{
+    LOCK(cs_witnesses);
+    if (!mapWitnesses.count(hashPubcoin))
+        return false;
+
+    mintWitness = mapWitnesses.at(hashPubcoin);
+    return true;
+}
+
+void CzESCOTracker::SetWitness(const uint256& hashPubcoin, const CMintWitness& mintWitness)
+{
+    if (mintWitness.listProgress.empty()) {
+        EraseWitness(hashPubcoin);
+        return;
+    }
+
+    LOCK(cs_witnesses);
+    mapWitnesses[hashPubcoin] = mintWitness;
+    if (!CWalletDB(strWalletFile).WriteMintWitness(hashPubcoin, mintWitness))
+        LogPrintf("%s: failed to write witness of %s\n", __func__, hashPubcoin.GetHex());
+}
+
+void CzESCOTracker::EraseWitness(const uint256& hashPubcoin)
+{
+    LOCK(cs_witnesses);
+    if (mapWitnesses.erase(hashPubcoin))
+        CWalletDB(strWalletFile).EraseMintWitness(hashPubcoin);
+}
+
+void CzESCOTracker::WitnessStateChanged(const uint256& hashSerial)
+{
+    LOCK(cs_witnesses);
+    setWitnessChanged.insert(hashSerial);
+}
+
+//Look at the mints that changed: drop the witnesses of spent and archived ones, and list the confirmed ones still without one
+void CzESCOTracker::PruneWitnesses(std::vector<CMintMeta>& vNeedWitness)
+{
+    LOCK(cs_witnesses);
+    std::set<uint256>::iterator it = setWitnessChanged.begin();
+    while (it != setWitnessChanged.end()) {
+        std::map<uint256, CMintMeta>::const_iterator itMeta = mapSerialHashes.find(*it);
+        if (itMeta == mapSerialHashes.end()) {
+            setWitnessChanged.erase(it++);
+            continue;
+        }
+
+        const CMintMeta& meta = itMeta->second;
+        if (meta.isUsed || meta.isArchived) {
+            EraseWitness(meta.hashPubcoin);
+            setWitnessChanged.erase(it++);
+            continue;
+        }
+
+        if (mapWitnesses.count(meta.hashPubcoin)) {
+            setWitnessChanged.erase(it++);
+            continue;
+        }
+
+        // Stays queued until its witness exists, a mint that is not confirmed yet is looked at again on the next tip
+        if (vNeedWitness.size() < MAX_WITNESS_INITS)
+            vNeedWitness.emplace_back(meta);
+        ++it;
+    }
+}
+
+//Add the blocks of each new accumulator checkpoint to the witnesses, dropping state that was reorganized away
+void CzESCOTracker::UpdateWitnesses(const CBlockIndex* pindexTip)
+{
+    int nHeightStop = GetWitnessStopHeight(pindexTip->nHeight);
+
+    std::vector<uint256> vHashes;
+    {
+        LOCK(cs_witnesses);
+        for (auto& it : mapWitnesses)
+            vHashes.emplace_back(it.first);
+    }
+
+    for (const uint256& hashPubcoin : vHashes) {
+        boost::this_thread::interruption_point();
+
+        CMintWitness mintWitness;
+        if (!GetWitness(hashPubcoin, mintWitness))
+            continue;
+
+        size_t nStates = mintWitness.listProgress.size();
+        uint256 hashBlockLast = nStates ? mintWitness.listProgress.front().hashBlockLast : 0;
+
+        // The expensive part runs without holding cs_witnesses, so spends are not blocked by it
+        if (!AdvanceAccumulatorWitness(mintWitness, nHeightStop) && mintWitness.listProgress.empty())
+            LogPrint("zero", "%s: witness of %s was reorganized away\n", __func__, hashPubcoin.GetHex());
+
+        // Only write the witnesses that moved
+        if (mintWitness.listProgress.size() == nStates && nStates && mintWitness.listProgress.front().hashBlockLast == hashBlockLast)
+            continue;
+
+        LOCK(cs_witnesses);
+        if (mapWitnesses.count(hashPubcoin))
+            SetWitness(hashPubcoin, mintWitness);
+    }
+}
+
 CMintMeta CzESCOTracker::GetMetaFromPubcoin(const uint256& hashPubcoin)
 {
     for (auto it : mapSerialHashes) {
@@ -229,6 +354,7 @@ bool CzESCOTracker::UpdateZerocoinMint(const CZerocoinMint& mint)
     meta.denom = mint.GetDenomination();
     meta.nHeight = mint.GetHeight();
     mapSerialHashes.at(hashSerial) = meta;
+    WitnessStateChanged(hashSerial);
 
     //Write to db
     return CWalletDB(strWalletFile).WriteZerocoinMint(mint);
@@ -273,6 +399,7 @@ bool CzESCOTracker::UpdateState(const CMintMeta& meta)
     }
 
     mapSerialHashes[meta.hashSerial] = meta;
+    WitnessStateChanged(meta.hashSerial);
 
     return true;
 }
@@ -291,6 +418,7 @@ void CzESCOTracker::Add(const CDeterministicMint& dMint, bool isNew, bool isArch
     meta.isArchived = isArchived;
     meta.isDeterministic = true;
     mapSerialHashes[meta.hashSerial] = meta;
+    WitnessStateChanged(meta.hashSerial);
 
     if (isNew)
         CWalletDB(strWalletFile).WriteDeterministicMint(dMint);
@@ -311,6 +439,7 @@ void CzESCOTracker::Add(const CZerocoinMint& mint, bool isNew, bool isArchived)
     meta.isArchived = isArchived;
     meta.isDeterministic = false;
     mapSerialHashes[meta.hashSerial] = meta;
+    WitnessStateChanged(meta.hashSerial);
 
     if (isNew)
         CWalletDB(strWalletFile).WriteZerocoinMint(mint);
@@ -492,4 +621,7 @@ std::set<CMintMeta> CzESCOTracker::ListMints(bool fUnusedOnly, bool fMatureOnly,
 void CzESCOTracker::Clear()
 {
     mapSerialHashes.clear();
+    LOCK(cs_witnesses);
+    mapWitnesses.clear();
+    setWitnessChanged.clear();
 }
\ No newline at end of file
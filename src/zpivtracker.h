@@ -6,9 +6,12 @@
 #ifndef Escrow_ZESCOTRACKER_H
 #define Escrow_ZESCOTRACKER_H
 
+#include "accumulators.h"
 #include "primitives/zerocoin.h"
+#include "sync.h"
 #include <list>
 
+class CBlockIndex;
 class CDeterministicMint;
 
 class CzESCOTracker
@@ -19,7 +22,17 @@ private:
     std::map<uint256, CMintMeta> mapSerialHashes;
     std::map<uint256, uint256> mapPendingSpends; //serialhash, txid of spend
     bool UpdateStatusInternal(const std::set<uint256>& setMempool, CMintMeta& mint);
+
+    //! witnesses of confirmed mints, advanced as the chain grows and kept in the wallet db (pubcoinhash, witness)
+    std::map<uint256, CMintWitness> mapWitnesses;
+    //! serial hashes of mints whose state changed since PruneWitnesses last looked at them
+    std::set<uint256> setWitnessChanged;
+    CCriticalSection cs_witnesses;
+    void WitnessStateChanged(const uint256& hashSerial);
 public:
+    //! number of mints PruneWitnesses hands out for a new witness per call, creating one costs as much as a first spend
+    static const unsigned int MAX_WITNESS_INITS = 10;
+
     CzESCOTracker(std::string strWalletFile);
     ~CzESCOTracker();
     void Add(const CDeterministicMint& dMint, bool isNew = false, bool isArchived = false);
@@ -33,6 +46,11 @@ public:
     bool IsEmpty() const { return mapSerialHashes.empty(); }
     void Init();
     CMintMeta Get(const uint256& hashSerial);
+    bool GetWitness(const uint256& hashPubcoin, CMintWitness& mintWitness);
+    void SetWitness(const uint256& hashPubcoin, const CMintWitness& mintWitness);
+    void EraseWitness(const uint256& hashPubcoin);
+    void PruneWitnesses(std::vector<CMintMeta>& vNeedWitness);
+    void UpdateWitnesses(const CBlockIndex* pindexTip);
     CMintMeta GetMetaFromPubcoin(const uint256& hashPubcoin);
     bool GetMetaFromStakeHash(const uint256& hashStake, CMintMeta& meta) const;
     CAmount GetBalance(bool fConfirmedOnly, bool fUnconfirmedOnly) const;